@@ -0,0 +1,290 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <core/language_layer.h>
+
+// NOTE(bryson): tiny benchmark harness. A benchmark is a function that performs ops_per_sample
+// operations, it is timed n_samples times after a few warmup runs and every sample is turned into
+// nanoseconds per operation. Results are printed as they finish, as CSV or as a single JSON document,
+// with the label of the build so runs of different builds can be diffed with --compare.
+
+#define BENCH_MAX_COMPARE_ROWS 256
+
+typedef void (*BenchFunc)(void* user);
+
+typedef enum BenchFormat {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON,
+} BenchFormat;
+
+typedef struct BenchOptions {
+    BenchFormat format;
+    u32 n_samples;
+    u32 n_warmup;
+    // only run benchmarks whose name contains filter
+    char* filter;
+    // free-form name of the build, written into every row
+    char* label;
+    // 0 uses one worker per cpu
+    u32 n_workers;
+    b32 pin_workers;
+    // run the io benchmarks on the blocking fallback instead of io_uring
+    b32 io_blocking;
+    // set by --compare, the two result files to diff instead of running anything
+    char* compare_base;
+    char* compare_new;
+} BenchOptions;
+
+typedef struct Bench {
+    BenchOptions options;
+    u32 n_workers;
+    u32 n_results;
+    f64* samples;
+    u32 samples_capacity;
+} Bench;
+
+typedef struct BenchResult {
+    char* name;
+    char* param;
+    u64 ops_per_sample;
+    u32 n_samples;
+    f64 mean_ns;
+    f64 min_ns;
+    f64 p50_ns;
+    f64 p90_ns;
+    f64 p99_ns;
+    f64 max_ns;
+    f64 ops_per_second;
+} BenchResult;
+
+u64 bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000000000ull + (u64) ts.tv_nsec;
+}
+
+BenchOptions bench_default_options() {
+    BenchOptions options = {
+        .format = BENCH_FORMAT_CSV,
+        .n_samples = 30,
+        .n_warmup = 3,
+        .filter = NULL,
+        .label = "default",
+        .n_workers = 0,
+        .pin_workers = true,
+        .io_blocking = false,
+        .compare_base = NULL,
+        .compare_new = NULL,
+    };
+    return options;
+}
+
+void bench_usage(char* program) {
+    fprintf(stderr,
+            "usage: %s [--format csv|json] [--samples n] [--warmup n] [--filter name] [--label build]\n"
+            "          [--workers n] [--no-pin] [--io-blocking]\n"
+            "       %s --compare base.csv new.csv\n",
+            program, program);
+}
+
+// returns false on bad arguments
+b32 bench_parse_args(BenchOptions* options, int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        char* arg = argv[i];
+        b32 has_value = i + 1 < argc;
+        if (strcmp(arg, "--format") == 0 && has_value) {
+            char* format = argv[++i];
+            if (strcmp(format, "csv") == 0) options->format = BENCH_FORMAT_CSV;
+            else if (strcmp(format, "json") == 0) options->format = BENCH_FORMAT_JSON;
+            else return false;
+        }
+        else if (strcmp(arg, "--samples") == 0 && has_value) {
+            u32 n_samples = (u32) atoi(argv[++i]);
+            options->n_samples = ClampBot(n_samples, 1);
+        }
+        else if (strcmp(arg, "--warmup") == 0 && has_value) options->n_warmup = (u32) atoi(argv[++i]);
+        else if (strcmp(arg, "--filter") == 0 && has_value) options->filter = argv[++i];
+        else if (strcmp(arg, "--label") == 0 && has_value) options->label = argv[++i];
+        else if (strcmp(arg, "--workers") == 0 && has_value) options->n_workers = (u32) atoi(argv[++i]);
+        else if (strcmp(arg, "--no-pin") == 0) options->pin_workers = false;
+        else if (strcmp(arg, "--io-blocking") == 0) options->io_blocking = true;
+        else if (strcmp(arg, "--compare") == 0 && i + 2 < argc) {
+            options->compare_base = argv[++i];
+            options->compare_new = argv[++i];
+        }
+        else return false;
+    }
+    return true;
+}
+
+void bench_begin(Bench* bench, BenchOptions options, u32 n_workers) {
+    bench->options = options;
+    bench->n_workers = n_workers;
+    bench->n_results = 0;
+    bench->samples = NULL;
+    bench->samples_capacity = 0;
+
+    if (options.format == BENCH_FORMAT_CSV) {
+        printf("label,benchmark,param,workers,samples,ops_per_sample,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,max_ns,ops_per_second\n");
+    }
+    else {
+        printf("{\"label\":\"%s\",\"workers\":%u,\"results\":[", options.label, n_workers);
+    }
+    fflush(stdout);
+}
+
+void bench_end(Bench* bench) {
+    if (bench->options.format == BENCH_FORMAT_JSON) {
+        printf("\n]}\n");
+    }
+    free(bench->samples);
+    bench->samples = NULL;
+}
+
+int bench_compare_f64(const void* a, const void* b) {
+    f64 x = *(const f64*) a;
+    f64 y = *(const f64*) b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of sorted samples
+f64 bench_percentile(f64* sorted, u32 count, f64 percentile) {
+    u32 rank = (u32) (percentile / 100.0 * (f64) count + 0.5);
+    return sorted[ClampTop(ClampBot(rank, 1), count) - 1];
+}
+
+void bench_report(Bench* bench, BenchResult* result) {
+    if (bench->options.format == BENCH_FORMAT_CSV) {
+        printf("%s,%s,%s,%u,%u,%llu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.0f\n", bench->options.label, result->name,
+               result->param, bench->n_workers, result->n_samples, (unsigned long long) result->ops_per_sample,
+               result->mean_ns, result->min_ns, result->p50_ns, result->p90_ns, result->p99_ns, result->max_ns,
+               result->ops_per_second);
+    }
+    else {
+        printf("%s\n{\"benchmark\":\"%s\",\"param\":\"%s\",\"samples\":%u,\"ops_per_sample\":%llu,\"mean_ns\":%.2f,"
+               "\"min_ns\":%.2f,\"p50_ns\":%.2f,\"p90_ns\":%.2f,\"p99_ns\":%.2f,\"max_ns\":%.2f,\"ops_per_second\":%.0f}",
+               bench->n_results == 0 ? "" : ",", result->name, result->param, result->n_samples,
+               (unsigned long long) result->ops_per_sample, result->mean_ns, result->min_ns, result->p50_ns,
+               result->p90_ns, result->p99_ns, result->max_ns, result->ops_per_second);
+    }
+    bench->n_results += 1;
+    fflush(stdout);
+}
+
+b32 bench_enabled(Bench* bench, char* name) {
+    return bench->options.filter == NULL || strstr(name, bench->options.filter) != NULL;
+}
+
+// Times function n_samples times (0 uses the default from the options) and reports the time per
+// operation. Every call of function has to perform ops_per_sample operations. setup and teardown (both
+// optional) run around every call, outside of the timed region.
+void bench_run_with(Bench* bench, char* name, char* param, u64 ops_per_sample, u32 n_samples, BenchFunc setup,
+                    BenchFunc function, BenchFunc teardown, void* user) {
+    if (!bench_enabled(bench, name)) {
+        return;
+    }
+
+    n_samples = n_samples ? n_samples : bench->options.n_samples;
+    if (n_samples > bench->samples_capacity) {
+        bench->samples = (f64*) realloc(bench->samples, sizeof(f64) * n_samples);
+        bench->samples_capacity = n_samples;
+    }
+
+    for (u32 i = 0; i < bench->options.n_warmup; ++i) {
+        if (setup) setup(user);
+        function(user);
+        if (teardown) teardown(user);
+    }
+
+    f64 total = 0.0;
+    for (u32 i = 0; i < n_samples; ++i) {
+        if (setup) setup(user);
+        u64 start = bench_now_ns();
+        function(user);
+        u64 elapsed = bench_now_ns() - start;
+        if (teardown) teardown(user);
+        bench->samples[i] = (f64) elapsed / (f64) ops_per_sample;
+        total += bench->samples[i];
+    }
+
+    qsort(bench->samples, n_samples, sizeof(f64), bench_compare_f64);
+    BenchResult result = {
+        .name = name,
+        .param = param,
+        .ops_per_sample = ops_per_sample,
+        .n_samples = n_samples,
+        .mean_ns = total / (f64) n_samples,
+        .min_ns = bench->samples[0],
+        .p50_ns = bench_percentile(bench->samples, n_samples, 50.0),
+        .p90_ns = bench_percentile(bench->samples, n_samples, 90.0),
+        .p99_ns = bench_percentile(bench->samples, n_samples, 99.0),
+        .max_ns = bench->samples[n_samples - 1],
+    };
+    result.ops_per_second = result.p50_ns > 0.0 ? 1e9 / result.p50_ns : 0.0;
+    bench_report(bench, &result);
+}
+
+void bench_run(Bench* bench, char* name, char* param, u64 ops_per_sample, u32 n_samples, BenchFunc function, void* user) {
+    bench_run_with(bench, name, param, ops_per_sample, n_samples, NULL, function, NULL, user);
+}
+
+#pragma region compare
+typedef struct BenchRow {
+    char key[128];
+    f64 p50_ns;
+} BenchRow;
+
+// reads benchmark,param -> p50_ns from a CSV written by this harness, returns the number of rows
+u32 bench_read_csv(char* path, BenchRow* rows, u32 max_rows) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "can't open %s\n", path);
+        return 0;
+    }
+
+    u32 n_rows = 0;
+    char line[512];
+    // skip the header
+    fgets(line, sizeof(line), file);
+    while (n_rows < max_rows && fgets(line, sizeof(line), file) != NULL) {
+        char* fields[13] = {0};
+        u32 n_fields = 0;
+        for (char* field = strtok(line, ",\n"); field != NULL && n_fields < 13; field = strtok(NULL, ",\n")) {
+            fields[n_fields++] = field;
+        }
+        if (n_fields < 13) {
+            continue;
+        }
+
+        BenchRow* row = &rows[n_rows++];
+        snprintf(row->key, sizeof(row->key), "%s %s", fields[1], fields[2]);
+        row->p50_ns = atof(fields[8]);
+    }
+    fclose(file);
+    return n_rows;
+}
+
+// Prints the median time per operation of every benchmark found in both files and how the new build
+// compares. A ratio above 1 means the new build is slower.
+void bench_compare(char* base_path, char* new_path) {
+    static BenchRow base[BENCH_MAX_COMPARE_ROWS];
+    static BenchRow next[BENCH_MAX_COMPARE_ROWS];
+    u32 n_base = bench_read_csv(base_path, base, BENCH_MAX_COMPARE_ROWS);
+    u32 n_next = bench_read_csv(new_path, next, BENCH_MAX_COMPARE_ROWS);
+
+    printf("%-40s %14s %14s %8s\n", "benchmark", "base p50 ns", "new p50 ns", "ratio");
+    for (u32 i = 0; i < n_next; ++i) {
+        for (u32 j = 0; j < n_base; ++j) {
+            if (strcmp(next[i].key, base[j].key) == 0) {
+                f64 ratio = base[j].p50_ns > 0.0 ? next[i].p50_ns / base[j].p50_ns : 0.0;
+                printf("%-40s %14.2f %14.2f %7.2fx\n", next[i].key, base[j].p50_ns, next[i].p50_ns, ratio);
+                break;
+            }
+        }
+    }
+}
+#pragma endregion
@@ -0,0 +1,783 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <core/jobs.h>
+#include <core/channel.h>
+#include <core/io.h>
+#include <core/str.h>
+#include <core/hash_table.h>
+
+#include "bench.h"
+
+// NOTE(bryson): standard microbenchmarks for the scheduler and the core containers, meant to be run
+// on every build so regressions show up. Write the results to a file per build and diff them:
+//   bench_suite --label before > before.csv
+//   bench_suite --label after > after.csv
+//   bench_suite --compare before.csv after.csv
+
+#pragma region scheduler
+#define EMPTY_JOB_BATCH 128
+#define FIB_N 22
+#define NQUEENS_N 9
+// rows placed by jobs, the rest of the board is searched serially
+#define NQUEENS_SPAWN_DEPTH 3
+#define PARALLEL_FOR_COUNT (1u << 20)
+#define TIMER_COUNT 100000
+// live jobs stay below MAX_JOB_COUNT, every timer has a continuation waiting on it
+#define TIMER_EXTERNAL_COUNT 64
+#define PIPELINE_ITEMS 10000
+#define CHANNEL_ROUND_TRIPS 100000
+#define CHANNEL_CAPACITY 1024
+
+void empty_job(Job* job, void* data) {
+}
+
+void run_and_wait(Job* job) {
+    Worker* worker = job_system_thread_worker();
+    JobHandle handle = job_handle(job);
+    worker_submit(worker, job);
+    worker_wait_handle(worker, handle);
+}
+
+void bench_empty_jobs(void* user) {
+    Worker* worker = job_system_thread_worker();
+    Job* root = job_create(&empty_job);
+    for (u32 i = 0; i < EMPTY_JOB_BATCH; ++i) {
+        worker_submit(worker, job_create_child(root, &empty_job));
+    }
+    run_and_wait(root);
+}
+
+void bench_empty_jobs_batched(void* user) {
+    Worker* worker = job_system_thread_worker();
+    Job* root = job_create(&empty_job);
+    Job* children[EMPTY_JOB_BATCH];
+    for (u32 i = 0; i < EMPTY_JOB_BATCH; ++i) {
+        children[i] = job_create_child(root, &empty_job);
+    }
+    worker_submit_batch(worker, children, EMPTY_JOB_BATCH);
+    run_and_wait(root);
+}
+
+// submit cost alone, the jobs are created up front and run after the clock stopped
+typedef struct SubmitBench {
+    Job* root;
+    Job* children[EMPTY_JOB_BATCH];
+    b32 batched;
+} SubmitBench;
+
+void submit_bench_setup(void* user) {
+    SubmitBench* sb = (SubmitBench*) user;
+    sb->root = job_create(&empty_job);
+    for (u32 i = 0; i < EMPTY_JOB_BATCH; ++i) {
+        sb->children[i] = job_create_child(sb->root, &empty_job);
+    }
+}
+
+void bench_submit(void* user) {
+    SubmitBench* sb = (SubmitBench*) user;
+    Worker* worker = job_system_thread_worker();
+    if (sb->batched) {
+        worker_submit_batch(worker, sb->children, EMPTY_JOB_BATCH);
+    }
+    else {
+        for (u32 i = 0; i < EMPTY_JOB_BATCH; ++i) {
+            worker_submit(worker, sb->children[i]);
+        }
+    }
+}
+
+void submit_bench_teardown(void* user) {
+    SubmitBench* sb = (SubmitBench*) user;
+    run_and_wait(sb->root);
+}
+
+void bench_submit_latency(void* user) {
+    run_and_wait(job_create(&empty_job));
+}
+
+typedef struct FibData {
+    u32 n;
+    u64* result;
+} FibData;
+
+u64 fib_serial(u32 n) {
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+// number of jobs a fib(n) run spawns, one per call
+u64 fib_calls(u32 n) {
+    return n < 2 ? 1 : 1 + fib_calls(n - 1) + fib_calls(n - 2);
+}
+
+// no serial cutoff, so every call is a job and the run is pure scheduling overhead
+void fib_job(Job* job, void* data) {
+    FibData* fib_data = (FibData*) data;
+    if (fib_data->n < 2) {
+        *fib_data->result = fib_data->n;
+        return;
+    }
+
+    Worker* worker = job_system_thread_worker();
+    u64 left_result = 0;
+    u64 right_result = 0;
+    FibData left_data = {.n = fib_data->n - 1, .result = &left_result};
+    FibData right_data = {.n = fib_data->n - 2, .result = &right_result};
+
+    Job* left = job_create(&fib_job);
+    job_write_data(left, (char*) &left_data, sizeof(FibData));
+    JobHandle left_handle = job_handle(left);
+    Job* right = job_create(&fib_job);
+    job_write_data(right, (char*) &right_data, sizeof(FibData));
+    JobHandle right_handle = job_handle(right);
+
+    worker_submit(worker, left);
+    worker_submit(worker, right);
+    worker_wait_handle(worker, right_handle);
+    worker_wait_handle(worker, left_handle);
+
+    *fib_data->result = left_result + right_result;
+}
+
+void bench_fib(void* user) {
+    u64 result = 0;
+    FibData data = {.n = FIB_N, .result = &result};
+    Job* root = job_create(&fib_job);
+    job_write_data(root, (char*) &data, sizeof(FibData));
+    run_and_wait(root);
+    Assert(result == fib_serial(FIB_N));
+}
+
+typedef struct NQueensData {
+    u32 row;
+    u64* solutions;
+    u8 columns[16];
+} NQueensData;
+
+b32 nqueens_safe(u8* columns, u32 row, u32 column) {
+    for (u32 r = 0; r < row; ++r) {
+        u32 c = columns[r];
+        if (c == column || c + (row - r) == column || c == column + (row - r)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+u64 nqueens_serial(u8* columns, u32 row) {
+    if (row == NQUEENS_N) {
+        return 1;
+    }
+    u64 solutions = 0;
+    for (u32 column = 0; column < NQUEENS_N; ++column) {
+        if (nqueens_safe(columns, row, column)) {
+            columns[row] = (u8) column;
+            solutions += nqueens_serial(columns, row + 1);
+        }
+    }
+    return solutions;
+}
+
+// every safe placement in the first rows becomes a child job, completion is tracked by the parent
+// counts instead of waiting
+void nqueens_job(Job* job, void* data) {
+    NQueensData* queens = (NQueensData*) data;
+    if (queens->row >= NQUEENS_SPAWN_DEPTH) {
+        u64 solutions = nqueens_serial(queens->columns, queens->row);
+        __atomic_fetch_add(queens->solutions, solutions, __ATOMIC_RELAXED);
+        return;
+    }
+
+    Worker* worker = job_system_thread_worker();
+    for (u32 column = 0; column < NQUEENS_N; ++column) {
+        if (nqueens_safe(queens->columns, queens->row, column)) {
+            NQueensData child_data = *queens;
+            child_data.columns[queens->row] = (u8) column;
+            child_data.row = queens->row + 1;
+
+            Job* child = job_create_child(job, &nqueens_job);
+            job_write_data(child, (char*) &child_data, sizeof(NQueensData));
+            worker_submit(worker, child);
+        }
+    }
+}
+
+void bench_nqueens(void* user) {
+    u64 solutions = 0;
+    NQueensData data = {.row = 0, .solutions = &solutions};
+    Job* root = job_create(&nqueens_job);
+    job_write_data(root, (char*) &data, sizeof(NQueensData));
+    run_and_wait(root);
+    Assert(solutions == 352);
+}
+
+typedef struct ParallelForBench {
+    f32* values;
+    u32 grain_size;
+} ParallelForBench;
+
+void saxpy(void* data, u32 count) {
+    f32* values = (f32*) data;
+    for (u32 i = 0; i < count; ++i) {
+        values[i] = values[i] * 1.0001f + 0.5f;
+    }
+}
+
+void bench_parallel_for(void* user) {
+    ParallelForBench* pf = (ParallelForBench*) user;
+    run_and_wait(parallel_for(pf->values, PARALLEL_FOR_COUNT, sizeof(f32), pf->grain_size, &saxpy));
+}
+
+// adds timers spread over the next hour and cancels them again, none of them fires
+void bench_timers(void* user) {
+    JobTimer* timers = (JobTimer*) user;
+    for (u32 i = 0; i < TIMER_COUNT; ++i) {
+        u64 delay_ms = 1000 + (i * 2654435761u) % 3600000;
+        timers[i] = job_submit_after(job_create(&empty_job), delay_ms * 1000000ull);
+    }
+    for (u32 i = 0; i < TIMER_COUNT; ++i) {
+        b32 cancelled = job_timer_cancel(timers[i]);
+        Assert(cancelled);
+    }
+}
+
+typedef struct TimerCancelBench {
+    Job* timed[TIMER_EXTERNAL_COUNT];
+    i32 n_continued;
+} TimerCancelBench;
+
+void count_continuation_job(Job* job, void* data) {
+    TimerCancelBench* tb = *(TimerCancelBench**) data;
+    atomic_increment(&tb->n_continued);
+}
+
+// not a worker, so cancelling finishes the timed jobs here and their continuations go through the
+// injection queue
+void* timer_cancel_thread(void* arg) {
+    TimerCancelBench* tb = (TimerCancelBench*) arg;
+    for (u32 i = 0; i < TIMER_EXTERNAL_COUNT; ++i) {
+        JobTimer timer = job_submit_after(tb->timed[i], 3600ull * 1000000000ull);
+        b32 cancelled = job_timer_cancel(timer);
+        Assert(cancelled);
+    }
+    return NULL;
+}
+
+// timers with a continuation each, added and cancelled from another thread. Every continuation runs.
+void bench_timers_external(void* user) {
+    TimerCancelBench* tb = (TimerCancelBench*) user;
+    tb->n_continued = 0;
+    Job* root = job_create(&empty_job);
+    for (u32 i = 0; i < TIMER_EXTERNAL_COUNT; ++i) {
+        tb->timed[i] = job_create(&empty_job);
+        Job* continuation = job_create_child(root, &count_continuation_job);
+        job_write_data(continuation, (char*) &tb, sizeof(TimerCancelBench*));
+        job_add_continuation(tb->timed[i], continuation);
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, &timer_cancel_thread, tb);
+    pthread_join(thread, NULL);
+    run_and_wait(root);
+    Assert(atomic_load_acquire(&tb->n_continued) == TIMER_EXTERNAL_COUNT);
+}
+
+// NOTE(bryson): parse, transform and write records, the shape of a typical streaming job. Only the
+// middle stage does real work, the serial ends show what handing tokens through a stage costs.
+typedef struct PipelineBench {
+    Arena* arena;
+    u32 max_tokens;
+    u64 n_parsed;
+    u64 n_written;
+    u64 checksum;
+    u64 records[PIPELINE_ITEMS];
+} PipelineBench;
+
+void* pipeline_parse(void* item, void* user) {
+    PipelineBench* pb = (PipelineBench*) user;
+    if (pb->n_parsed == PIPELINE_ITEMS) {
+        return NULL;
+    }
+    u64* record = &pb->records[pb->n_parsed];
+    *record = pb->n_parsed++;
+    return record;
+}
+
+void* pipeline_transform(void* item, void* user) {
+    u64* record = (u64*) item;
+    u64 hash = *record;
+    for (u32 i = 0; i < 256; ++i) {
+        hash = hash * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    *record = hash;
+    return record;
+}
+
+void* pipeline_write(void* item, void* user) {
+    PipelineBench* pb = (PipelineBench*) user;
+    pb->checksum ^= *(u64*) item;
+    pb->n_written += 1;
+    return item;
+}
+
+void bench_pipeline(void* user) {
+    PipelineBench* pb = (PipelineBench*) user;
+    pb->n_parsed = 0;
+    pb->n_written = 0;
+    TempArena temp = temp_arena_begin(pb->arena);
+    Pipeline* pipeline = pipeline_create(pb->arena, pb->max_tokens, pb);
+    pipeline_add_stage(pipeline, PIPELINE_SERIAL_IN_ORDER, &pipeline_parse);
+    pipeline_add_stage(pipeline, PIPELINE_PARALLEL, &pipeline_transform);
+    pipeline_add_stage(pipeline, PIPELINE_SERIAL_IN_ORDER, &pipeline_write);
+    Worker* worker = job_system_thread_worker();
+    worker_wait_handle(worker, pipeline_submit(pipeline, worker));
+    temp_arena_end(&temp);
+    Assert(pb->n_written == PIPELINE_ITEMS);
+}
+
+typedef struct ChannelBench {
+    Channel* channel;
+    u32 n_jobs;
+} ChannelBench;
+
+// every job sends a value and takes one back, so the channel never runs dry and all workers contend
+// on both ends
+void channel_round_trip_job(Job* job, void* data) {
+    ChannelBench* cb = *(ChannelBench**) data;
+    u32 n_round_trips = CHANNEL_ROUND_TRIPS / cb->n_jobs;
+    for (u64 i = 0; i < n_round_trips; ++i) {
+        u64 value = i;
+        channel_send(cb->channel, &value);
+        b32 received = channel_recv(cb->channel, &value);
+        Assert(received);
+    }
+}
+
+void bench_channel(void* user) {
+    ChannelBench* cb = (ChannelBench*) user;
+    Job* root = job_create(&empty_job);
+    for (u32 i = 0; i < cb->n_jobs; ++i) {
+        Job* job = job_create_child(root, &channel_round_trip_job);
+        job_write_data(job, (char*) &cb, sizeof(ChannelBench*));
+        job_system_submit(job);
+    }
+    run_and_wait(root);
+}
+#pragma endregion
+
+#pragma region io
+#define IO_READS 256
+#define IO_BLOCK_SIZE 4096
+#define IO_ROUND_TRIPS 64
+#define IO_MESSAGE_SIZE 64
+
+typedef struct IoBench {
+    i32 file;
+    // a connected pair of loopback tcp sockets
+    i32 client;
+    i32 server;
+    IoRequest requests[IO_READS];
+} IoBench;
+
+void io_bench_read_done(Job* job, void* data) {
+    IoRequest* request = *(IoRequest**) data;
+    Assert(request->result == IO_BLOCK_SIZE);
+    io_buffer_release(request->buffer);
+}
+
+// IO_READS reads of a cached file in flight at once, every completion runs a continuation
+void bench_io_read(void* user) {
+    IoBench* ib = (IoBench*) user;
+    Job* root = job_create(&empty_job);
+    for (u32 i = 0; i < IO_READS; ++i) {
+        IoRequest* request = &ib->requests[i];
+        Job* done = job_create_child(root, &io_bench_read_done);
+        job_write_data(done, (char*) &request, sizeof(request));
+        io_read(request, ib->file, io_buffer_acquire(), IO_BLOCK_SIZE, (u64) i * IO_BLOCK_SIZE, done);
+    }
+    run_and_wait(root);
+}
+
+// one message from the client to the server and back per round trip
+void bench_io_loopback(void* user) {
+    IoBench* ib = (IoBench*) user;
+    IoBuffer* buffer = io_buffer_acquire();
+    for (u32 i = 0; i < IO_ROUND_TRIPS; ++i) {
+        i32 from = (i & 1) ? ib->server : ib->client;
+        i32 to = (i & 1) ? ib->client : ib->server;
+        Job* sent = job_create(&empty_job);
+        Job* received = job_create(&empty_job);
+        JobHandle sent_handle = job_handle(sent);
+        JobHandle received_handle = job_handle(received);
+        io_read(&ib->requests[0], to, buffer, IO_MESSAGE_SIZE, IO_OFFSET_NONE, received);
+        io_write(&ib->requests[1], from, buffer, IO_MESSAGE_SIZE, IO_OFFSET_NONE, sent);
+        job_system_wait(sent_handle);
+        job_system_wait(received_handle);
+        Assert(ib->requests[0].result == IO_MESSAGE_SIZE);
+    }
+    io_buffer_release(buffer);
+}
+
+void io_bench_open(IoBench* ib) {
+    char path[] = "/tmp/bench_io_XXXXXX";
+    ib->file = mkstemp(path);
+    unlink(path);
+    byte block[IO_BLOCK_SIZE] = {0};
+    for (u32 i = 0; i < IO_READS; ++i) {
+        ssize_t written = pwrite(ib->file, block, IO_BLOCK_SIZE, (off_t) i * IO_BLOCK_SIZE);
+        Assert(written == IO_BLOCK_SIZE);
+    }
+
+    i32 listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = 0,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t length = sizeof(address);
+    bind(listener, (struct sockaddr*) &address, sizeof(address));
+    listen(listener, 1);
+    getsockname(listener, (struct sockaddr*) &address, &length);
+    ib->client = socket(AF_INET, SOCK_STREAM, 0);
+    connect(ib->client, (struct sockaddr*) &address, sizeof(address));
+    ib->server = accept(listener, NULL, NULL);
+    close(listener);
+}
+
+void io_bench_close(IoBench* ib) {
+    close(ib->file);
+    close(ib->client);
+    close(ib->server);
+}
+#pragma endregion
+
+#pragma region containers
+#define HASH_TABLE_KEYS 65536
+#define ARENA_ALLOCS 100000
+// bytes pushed per sample by arena_push, split into allocations of the size under test
+#define ARENA_PUSH_BYTES Megabytes(64)
+#define STRING_BUILDER_PARTS 10000
+// alloc and free pairs per sample of the pool benchmarks, which hold POOL_LIVE elements at a time
+#define POOL_OPS 1048576
+#define POOL_LIVE 64
+#define POOL_ELEMENT_SIZE 64
+
+typedef struct HashTableBench {
+    Arena* arena;
+    char** keys;
+    HashTable table;
+} HashTableBench;
+
+void bench_hash_table_insert(void* user) {
+    HashTableBench* hb = (HashTableBench*) user;
+    TempArena tmp = temp_arena_begin(hb->arena);
+    HashTable table = hash_table_create(hb->arena, HASH_TABLE_KEYS);
+    for (u32 i = 0; i < HASH_TABLE_KEYS; ++i) {
+        hash_table_insert(&table, hb->keys[i], (byte*) hb->keys[i]);
+    }
+    temp_arena_end(&tmp);
+}
+
+void bench_hash_table_get(void* user) {
+    HashTableBench* hb = (HashTableBench*) user;
+    u64 found = 0;
+    for (u32 i = 0; i < HASH_TABLE_KEYS; ++i) {
+        found += hash_table_get(&hb->table, hb->keys[i]) != NULL;
+    }
+    Assert(found == HASH_TABLE_KEYS);
+}
+
+typedef struct ArenaBench {
+    Arena* arena;
+    u64 size;
+} ArenaBench;
+
+void bench_arena_alloc(void* user) {
+    ArenaBench* ab = (ArenaBench*) user;
+    TempArena tmp = temp_arena_begin(ab->arena);
+    for (u32 i = 0; i < ARENA_ALLOCS; ++i) {
+        byte* memory = arena_alloc(ab->arena, ab->size);
+        Assert(memory != NULL);
+    }
+    temp_arena_end(&tmp);
+}
+
+// NOTE(bryson): scratch buffers that are overwritten right away. Every allocation is filled once, so
+// the zeroing push pays for writing the memory twice and the no_zero push only once. The arena is
+// rewound between samples, so after the first one all of it is reused memory the zeroing push has to
+// clear.
+typedef struct ArenaPushBench {
+    Arena* arena;
+    u64 size;
+    b32 zero;
+} ArenaPushBench;
+
+void bench_arena_push(void* user) {
+    ArenaPushBench* ab = (ArenaPushBench*) user;
+    TempArena tmp = temp_arena_begin(ab->arena);
+    for (u64 i = 0; i < ARENA_PUSH_BYTES / ab->size; ++i) {
+        byte* memory = ab->zero ? arena_alloc(ab->arena, ab->size) : arena_alloc_no_zero(ab->arena, ab->size);
+        Assert(memory != NULL);
+        MemorySet(memory, (int) i, ab->size);
+    }
+    temp_arena_end(&tmp);
+}
+
+void bench_string_builder(void* user) {
+    Arena* arena = (Arena*) user;
+    TempArena tmp = temp_arena_begin(arena);
+    StringBuilder sb = string_builder_create(arena);
+    for (u32 i = 0; i < STRING_BUILDER_PARTS; ++i) {
+        string_builder_append(&sb, "telemetry frame ");
+    }
+    String str = string_builder_build(&sb);
+    Assert(str.length == STRING_BUILDER_PARTS * 16);
+    temp_arena_end(&tmp);
+}
+
+typedef enum PoolBenchMode {
+    // every job has a PoolCache of its own
+    POOL_BENCH_CACHE,
+    // every alloc and free takes the pool's lock
+    POOL_BENCH_LOCKED,
+    POOL_BENCH_MALLOC,
+} PoolBenchMode;
+
+typedef struct PoolBench {
+    Pool* pool;
+    PoolBenchMode mode;
+    // 0 runs on the calling thread straight on the pool, without any lock
+    u32 n_jobs;
+} PoolBench;
+
+char* pool_bench_mode_name(PoolBenchMode mode) {
+    switch (mode) {
+        case POOL_BENCH_CACHE: return "cache";
+        case POOL_BENCH_LOCKED: return "locked";
+        default: return "malloc";
+    }
+}
+
+byte* pool_bench_alloc(PoolBench* pb, PoolCache* cache) {
+    if (pb->mode == POOL_BENCH_MALLOC) {
+        return (byte*) malloc(POOL_ELEMENT_SIZE);
+    }
+    if (pb->n_jobs == 0) {
+        return pool_alloc_no_zero(pb->pool);
+    }
+    if (pb->mode == POOL_BENCH_CACHE) {
+        return pool_cache_alloc_no_zero(cache);
+    }
+    pthread_mutex_lock(&pb->pool->lock);
+    byte* element = pool_alloc_no_zero(pb->pool);
+    pthread_mutex_unlock(&pb->pool->lock);
+    return element;
+}
+
+void pool_bench_free(PoolBench* pb, PoolCache* cache, byte* element) {
+    if (pb->mode == POOL_BENCH_MALLOC) {
+        free(element);
+    }
+    else if (pb->n_jobs == 0) {
+        pool_free(pb->pool, element);
+    }
+    else if (pb->mode == POOL_BENCH_CACHE) {
+        pool_cache_free(cache, element);
+    }
+    else {
+        pthread_mutex_lock(&pb->pool->lock);
+        pool_free(pb->pool, element);
+        pthread_mutex_unlock(&pb->pool->lock);
+    }
+}
+
+void pool_bench_churn(PoolBench* pb, u64 n_ops) {
+    PoolCache cache = pool_cache_create(pb->pool);
+    byte* live[POOL_LIVE];
+    for (u64 i = 0; i < n_ops; i += POOL_LIVE) {
+        for (u32 j = 0; j < POOL_LIVE; ++j) {
+            live[j] = pool_bench_alloc(pb, &cache);
+            Assert(live[j] != NULL);
+            // touch it like a freshly built node would be
+            *(u64*) live[j] = i + j;
+        }
+        for (u32 j = 0; j < POOL_LIVE; ++j) {
+            pool_bench_free(pb, &cache, live[j]);
+        }
+    }
+    pool_cache_flush(&cache);
+}
+
+void pool_churn_job(Job* job, void* data) {
+    PoolBench* pb = *(PoolBench**) data;
+    pool_bench_churn(pb, POOL_OPS / pb->n_jobs);
+}
+
+void bench_pool(void* user) {
+    PoolBench* pb = (PoolBench*) user;
+    if (pb->n_jobs == 0) {
+        pool_bench_churn(pb, POOL_OPS);
+        return;
+    }
+    Job* root = job_create(&empty_job);
+    for (u32 i = 0; i < pb->n_jobs; ++i) {
+        Job* job = job_create_child(root, &pool_churn_job);
+        job_write_data(job, (char*) &pb, sizeof(PoolBench*));
+        job_system_submit(job);
+    }
+    run_and_wait(root);
+}
+#pragma endregion
+
+int main(int argc, char** argv) {
+    BenchOptions options = bench_default_options();
+    if (!bench_parse_args(&options, argc, argv)) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+    if (options.compare_base != NULL) {
+        bench_compare(options.compare_base, options.compare_new);
+        return 0;
+    }
+
+    JobSystemOptions job_options = job_system_default_options();
+    job_options.n_workers = options.n_workers;
+    job_options.pin_workers = options.pin_workers;
+    job_system_init_with_options(job_options);
+
+    Bench bench;
+    // the job system's own threads, not the slots for external threads and spares
+    bench_begin(&bench, options, _job_system.first_external);
+    char param[64];
+
+    bench_run(&bench, "empty_job", "batch=128", EMPTY_JOB_BATCH + 1, 0, &bench_empty_jobs, NULL);
+    bench_run(&bench, "empty_job_batched", "batch=128", EMPTY_JOB_BATCH + 1, 0, &bench_empty_jobs_batched, NULL);
+
+    SubmitBench sb = {.batched = false};
+    bench_run_with(&bench, "submit", "single", EMPTY_JOB_BATCH, 0, &submit_bench_setup, &bench_submit, &submit_bench_teardown, &sb);
+    sb.batched = true;
+    bench_run_with(&bench, "submit", "batch=128", EMPTY_JOB_BATCH, 0, &submit_bench_setup, &bench_submit, &submit_bench_teardown, &sb);
+    bench_run(&bench, "submit_latency", "-", 1, options.n_samples * 100, &bench_submit_latency, NULL);
+    bench_run(&bench, "fib", "n=22", fib_calls(FIB_N), 0, &bench_fib, NULL);
+    bench_run(&bench, "nqueens", "n=9", 1, 0, &bench_nqueens, NULL);
+
+    ParallelForBench pf = {
+        .values = (f32*) malloc(sizeof(f32) * PARALLEL_FOR_COUNT),
+    };
+    for (u32 i = 0; i < PARALLEL_FOR_COUNT; ++i) {
+        pf.values[i] = (f32) i;
+    }
+    u32 grain_sizes[] = {0, 64, 256, 1024, 4096, 16384, 65536};
+    for (u32 i = 0; i < sizeof(grain_sizes) / sizeof(grain_sizes[0]); ++i) {
+        pf.grain_size = grain_sizes[i];
+        snprintf(param, sizeof(param), "grain=%u", grain_sizes[i]);
+        bench_run(&bench, "parallel_for", param, PARALLEL_FOR_COUNT, 0, &bench_parallel_for, &pf);
+    }
+    free(pf.values);
+
+    JobTimer* timers = (JobTimer*) malloc(sizeof(JobTimer) * TIMER_COUNT);
+    bench_run(&bench, "timer_add_cancel", "timers=100000", TIMER_COUNT, 0, &bench_timers, timers);
+    TimerCancelBench* tb = (TimerCancelBench*) malloc(sizeof(TimerCancelBench));
+    snprintf(param, sizeof(param), "timers=%u", TIMER_EXTERNAL_COUNT);
+    bench_run(&bench, "timer_cancel_external", param, TIMER_EXTERNAL_COUNT, 0, &bench_timers_external, tb);
+    free(tb);
+    free(timers);
+
+    Arena pipeline_arena = arena_create(Megabytes(1));
+    PipelineBench* pb = (PipelineBench*) malloc(sizeof(PipelineBench));
+    pb->arena = &pipeline_arena;
+    u32 token_counts[] = {1, 4, 16, 64};
+    for (u32 i = 0; i < sizeof(token_counts) / sizeof(token_counts[0]); ++i) {
+        pb->max_tokens = token_counts[i];
+        snprintf(param, sizeof(param), "tokens=%u", token_counts[i]);
+        bench_run(&bench, "pipeline", param, PIPELINE_ITEMS, 0, &bench_pipeline, pb);
+    }
+    free(pb);
+
+    ChannelBench cb = {
+        .channel = channel_create(&pipeline_arena, CHANNEL_CAPACITY, sizeof(u64)),
+        .n_jobs = _job_system.first_external,
+    };
+    snprintf(param, sizeof(param), "jobs=%u", cb.n_jobs);
+    bench_run(&bench, "channel_round_trip", param, CHANNEL_ROUND_TRIPS, 0, &bench_channel, &cb);
+    arena_release(&pipeline_arena);
+
+    IoOptions io_options = io_default_options();
+    io_options.n_buffers = IO_READS;
+    io_options.force_blocking = options.io_blocking;
+    IoBackend backend = io_init_with_options(io_options);
+    IoBench* ib = (IoBench*) malloc(sizeof(IoBench));
+    io_bench_open(ib);
+    char* backend_name = backend == IO_BACKEND_URING ? "io_uring" : "blocking";
+    snprintf(param, sizeof(param), "%s/size=4096", backend_name);
+    bench_run(&bench, "io_read", param, IO_READS, 0, &bench_io_read, ib);
+    snprintf(param, sizeof(param), "%s/size=64", backend_name);
+    bench_run(&bench, "io_loopback", param, IO_ROUND_TRIPS, 0, &bench_io_loopback, ib);
+    io_bench_close(ib);
+    free(ib);
+
+    Arena arena = arena_create(Megabytes(64));
+
+    HashTableBench hb = {
+        .arena = &arena,
+        .keys = arena_push_array(&arena, char*, HASH_TABLE_KEYS),
+    };
+    for (u32 i = 0; i < HASH_TABLE_KEYS; ++i) {
+        hb.keys[i] = arena_push_array(&arena, char, 16);
+        snprintf(hb.keys[i], 16, "key%u", i);
+    }
+    bench_run(&bench, "hash_table_insert", "keys=65536", HASH_TABLE_KEYS, 0, &bench_hash_table_insert, &hb);
+    hb.table = hash_table_create(&arena, HASH_TABLE_KEYS);
+    for (u32 i = 0; i < HASH_TABLE_KEYS; ++i) {
+        hash_table_insert(&hb.table, hb.keys[i], (byte*) hb.keys[i]);
+    }
+    bench_run(&bench, "hash_table_get", "keys=65536", HASH_TABLE_KEYS, 0, &bench_hash_table_get, &hb);
+
+    u64 alloc_sizes[] = {16, 64, 256};
+    for (u32 i = 0; i < sizeof(alloc_sizes) / sizeof(alloc_sizes[0]); ++i) {
+        ArenaBench ab = {.arena = &arena, .size = alloc_sizes[i]};
+        snprintf(param, sizeof(param), "size=%llu", (unsigned long long) alloc_sizes[i]);
+        bench_run(&bench, "arena_alloc", param, ARENA_ALLOCS, 0, &bench_arena_alloc, &ab);
+    }
+
+    bench_run(&bench, "string_builder_build", "parts=10000", STRING_BUILDER_PARTS, 0, &bench_string_builder, &arena);
+
+    ArenaOptions push_options = arena_default_options();
+    // keep the pages committed between samples
+    push_options.decommit_threshold = ARENA_PUSH_BYTES * 2;
+    Arena push_arena = arena_reserve(push_options);
+    u64 push_sizes[] = {64, Kilobytes(4), Kilobytes(64), Megabytes(1), Megabytes(16)};
+    for (u32 i = 0; i < sizeof(push_sizes) / sizeof(push_sizes[0]); ++i) {
+        for (u32 zero = 0; zero < 2; ++zero) {
+            ArenaPushBench ab = {.arena = &push_arena, .size = push_sizes[i], .zero = !zero};
+            snprintf(param, sizeof(param), "size=%llu/%s", (unsigned long long) push_sizes[i], ab.zero ? "zero" : "no_zero");
+            bench_run(&bench, "arena_push", param, ARENA_PUSH_BYTES / push_sizes[i], 0, &bench_arena_push, &ab);
+        }
+    }
+    arena_release(&push_arena);
+
+    Pool pool = pool_create(&arena, POOL_ELEMENT_SIZE, 256);
+    PoolBench pool_single[] = {
+        {.pool = &pool, .mode = POOL_BENCH_LOCKED, .n_jobs = 0},
+        {.pool = &pool, .mode = POOL_BENCH_MALLOC, .n_jobs = 0},
+    };
+    for (u32 i = 0; i < sizeof(pool_single) / sizeof(pool_single[0]); ++i) {
+        char* name = pool_single[i].mode == POOL_BENCH_MALLOC ? "malloc" : "pool";
+        snprintf(param, sizeof(param), "size=%u/%s", POOL_ELEMENT_SIZE, name);
+        bench_run(&bench, "pool_alloc_free", param, POOL_OPS, 0, &bench_pool, &pool_single[i]);
+    }
+    PoolBenchMode pool_modes[] = {POOL_BENCH_CACHE, POOL_BENCH_LOCKED, POOL_BENCH_MALLOC};
+    for (u32 i = 0; i < sizeof(pool_modes) / sizeof(pool_modes[0]); ++i) {
+        PoolBench pb = {.pool = &pool, .mode = pool_modes[i], .n_jobs = _job_system.first_external};
+        snprintf(param, sizeof(param), "jobs=%u/%s", pb.n_jobs, pool_bench_mode_name(pb.mode));
+        bench_run(&bench, "pool_alloc_free_jobs", param, POOL_OPS, 0, &bench_pool, &pb);
+    }
+
+    bench_end(&bench);
+    arena_release(&arena);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <core/jobs.h>
+
+// NOTE(bryson): deep recursive fork-join. Every fib job above the cutoff spawns two jobs and waits on
+// both, so waits nest as deep as the recursion. Each mode runs in its own process since the job
+// system can only be initialized once.
+
+typedef struct FibData {
+    u32 n;
+    u64* result;
+} FibData;
+
+u32 g_cutoff = 10;
+
+u64 fib_serial(u32 n) {
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+void fib_job(Job* job, void* data) {
+    FibData* fib_data = (FibData*) data;
+    if (fib_data->n <= g_cutoff) {
+        *fib_data->result = fib_serial(fib_data->n);
+        return;
+    }
+
+    Worker* worker = job_system_thread_worker();
+    u64 left_result = 0;
+    u64 right_result = 0;
+    FibData left_data = {.n = fib_data->n - 1, .result = &left_result};
+    FibData right_data = {.n = fib_data->n - 2, .result = &right_result};
+
+    Job* left = job_create(&fib_job);
+    job_write_data(left, (char*) &left_data, sizeof(FibData));
+    JobHandle left_handle = job_handle(left);
+    Job* right = job_create(&fib_job);
+    job_write_data(right, (char*) &right_data, sizeof(FibData));
+    JobHandle right_handle = job_handle(right);
+
+    worker_submit(worker, left);
+    worker_submit(worker, right);
+    worker_wait_handle(worker, right_handle);
+    worker_wait_handle(worker, left_handle);
+
+    *fib_data->result = left_result + right_result;
+}
+
+f64 now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64) ts.tv_sec + (f64) ts.tv_nsec * 1e-9;
+}
+
+void run_bench(b32 use_fibers, u32 n, u32 n_runs, u32 n_workers) {
+    JobSystemOptions options = job_system_default_options();
+    options.use_fibers = use_fibers;
+    options.n_workers = n_workers;
+    job_system_init_with_options(options);
+    Worker* worker = job_system_thread_worker();
+
+    u64 expected = fib_serial(n);
+    f64 best = 1e30;
+    for (u32 run = 0; run < n_runs; ++run) {
+        u64 result = 0;
+        FibData data = {.n = n, .result = &result};
+
+        f64 start = now_seconds();
+        Job* root = job_create(&fib_job);
+        job_write_data(root, (char*) &data, sizeof(FibData));
+        JobHandle handle = job_handle(root);
+        worker_submit(worker, root);
+        worker_wait_handle(worker, handle);
+        f64 elapsed = now_seconds() - start;
+
+        best = Min(best, elapsed);
+        if (result != expected) {
+            printf("%s: wrong result %llu, expected %llu\n", use_fibers ? "fibers" : "help-wait",
+                   (unsigned long long) result, (unsigned long long) expected);
+        }
+    }
+
+    printf("%-10s workers=%-3u fib(%u) cutoff=%u best=%8.3f ms\n", use_fibers ? "fibers" : "help-wait",
+           _job_system.first_external, n, g_cutoff, best * 1e3);
+}
+
+int main(int argc, char** argv) {
+    u32 n = argc > 1 ? (u32) atoi(argv[1]) : 30;
+    g_cutoff = argc > 2 ? (u32) atoi(argv[2]) : 10;
+    u32 n_runs = argc > 3 ? (u32) atoi(argv[3]) : 5;
+    u32 n_workers = argc > 4 ? (u32) atoi(argv[4]) : 0;
+
+    for (i32 mode = 0; mode < 2; ++mode) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_bench(mode == 1, n, n_runs, n_workers);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
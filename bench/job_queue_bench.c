@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <core/jobs.h>
+
+// NOTE(bryson): contention benchmark for the work-stealing deque. One owner thread pushes batches of
+// jobs and pops them back while a number of thieves hammer the top of the same queue. The old mutex
+// guarded queue is kept here so the two can be compared on the same machine.
+
+#pragma region mutex_queue
+typedef struct MutexJobQueue {
+    Job* jobs[MAX_JOB_COUNT];
+    u32 bottom;
+    u32 top;
+    pthread_mutex_t lock;
+} MutexJobQueue;
+
+b32 mutex_job_queue_push(void* q, Job* job) {
+    MutexJobQueue* queue = (MutexJobQueue*) q;
+    pthread_mutex_lock(&queue->lock);
+    b32 pushed = true;
+    if (queue->bottom - queue->top < MAX_JOB_COUNT) {
+        queue->jobs[queue->bottom & MOD_MASK] = job;
+        ++queue->bottom;
+    }
+    else {
+        pushed = false;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pushed;
+}
+
+Job* mutex_job_queue_pop(void* q) {
+    MutexJobQueue* queue = (MutexJobQueue*) q;
+    pthread_mutex_lock(&queue->lock);
+    Job* job = NULL;
+    i32 job_count = queue->bottom - queue->top;
+    if (job_count > 0)  {
+        --queue->bottom;
+        job = queue->jobs[queue->bottom & MOD_MASK];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+Job* mutex_job_queue_steal(void* q) {
+    MutexJobQueue* queue = (MutexJobQueue*) q;
+    pthread_mutex_lock(&queue->lock);
+    Job* job = NULL;
+    i32 job_count = queue->bottom - queue->top;
+    if (job_count > 0) {
+        job = queue->jobs[queue->top & MOD_MASK];
+        ++queue->top;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+#pragma endregion
+
+#pragma region lock_free_queue
+b32 lock_free_job_queue_push(void* q, Job* job) { return job_queue_push((JobQueue*) q, job); }
+Job* lock_free_job_queue_pop(void* q) { return job_queue_pop((JobQueue*) q); }
+Job* lock_free_job_queue_steal(void* q) { return job_queue_steal((JobQueue*) q); }
+#pragma endregion
+
+typedef struct QueueOps {
+    const char* name;
+    b32 (*push)(void*, Job*);
+    Job* (*pop)(void*);
+    Job* (*steal)(void*);
+} QueueOps;
+
+typedef struct BenchState {
+    QueueOps* ops;
+    void* queue;
+    u64 n_rounds;
+    i32 done;
+    u64 stolen;
+} BenchState;
+
+#define BATCH_SIZE 64
+Job g_dummy_job;
+
+f64 now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64) ts.tv_sec + (f64) ts.tv_nsec * 1e-9;
+}
+
+void* thief_proc(void* arg) {
+    BenchState* state = (BenchState*) arg;
+    u64 stolen = 0;
+    while (!atomic_load_acquire(&state->done)) {
+        if (!job_empty(state->ops->steal(state->queue))) {
+            ++stolen;
+        }
+    }
+    __atomic_fetch_add(&state->stolen, stolen, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void run_bench(QueueOps* ops, void* queue, u32 n_thieves, u64 n_rounds) {
+    BenchState state = {
+        .ops = ops,
+        .queue = queue,
+        .n_rounds = n_rounds,
+        .done = 0,
+        .stolen = 0,
+    };
+
+    pthread_t* thieves = malloc(sizeof(pthread_t) * n_thieves);
+    for (u32 i = 0; i < n_thieves; ++i) {
+        pthread_create(&thieves[i], NULL, thief_proc, &state);
+    }
+
+    u64 popped = 0;
+    f64 start = now_seconds();
+    for (u64 round = 0; round < n_rounds; ++round) {
+        for (u32 i = 0; i < BATCH_SIZE; ++i) {
+            ops->push(queue, &g_dummy_job);
+        }
+        while (!job_empty(ops->pop(queue))) {
+            ++popped;
+        }
+    }
+    f64 elapsed = now_seconds() - start;
+
+    atomic_store_release(&state.done, 1);
+    for (u32 i = 0; i < n_thieves; ++i) {
+        pthread_join(thieves[i], NULL);
+    }
+    free(thieves);
+
+    u64 total = n_rounds * BATCH_SIZE;
+    u64 taken = popped + state.stolen;
+    printf("%-10s thieves=%-3u jobs=%-10llu popped=%-10llu stolen=%-10llu %8.2f ns/job %s\n",
+           ops->name, n_thieves, (unsigned long long) total, (unsigned long long) popped,
+           (unsigned long long) state.stolen, elapsed * 1e9 / (f64) total,
+           taken == total ? "" : "MISMATCH");
+}
+
+int main(int argc, char** argv) {
+    u32 max_thieves = argc > 1 ? (u32) atoi(argv[1]) : (u32) ClampBot(get_available_cores() - 1, 1);
+    u64 n_rounds = argc > 2 ? (u64) atoll(argv[2]) : 100000;
+
+    QueueOps mutex_ops = {"mutex", mutex_job_queue_push, mutex_job_queue_pop, mutex_job_queue_steal};
+    QueueOps lock_free_ops = {"chase-lev", lock_free_job_queue_push, lock_free_job_queue_pop, lock_free_job_queue_steal};
+
+    MutexJobQueue* mutex_queue = calloc(1, sizeof(MutexJobQueue));
+    pthread_mutex_init(&mutex_queue->lock, NULL);
+    JobQueue* lock_free_queue = calloc(1, sizeof(JobQueue));
+
+    for (u32 n_thieves = 0; n_thieves <= max_thieves; n_thieves = n_thieves ? n_thieves * 2 : 1) {
+        run_bench(&mutex_ops, mutex_queue, n_thieves, n_rounds);
+        run_bench(&lock_free_ops, lock_free_queue, n_thieves, n_rounds);
+    }
+
+    pthread_mutex_destroy(&mutex_queue->lock);
+    free(mutex_queue);
+    free(lock_free_queue);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <core/jobs.h>
+
+// NOTE(bryson): parallel_reduce and parallel_scan against plain serial loops over u32 arrays. Sizes
+// go from 1M elements up to the passed maximum (default 256M, pass 1073741824 for 1G) in steps of 16x.
+// Scans run in place so the largest size only needs one array.
+
+#define N_SAMPLES 64
+
+void sum_reduce(void* data, u32 count, void* partial) {
+    u32* values = (u32*) data;
+    u64 sum = 0;
+    for (u32 i = 0; i < count; ++i) {
+        sum += values[i];
+    }
+    *(u64*) partial += sum;
+}
+
+void sum_combine(void* into, void* from) {
+    *(u32*) into += *(u32*) from;
+}
+
+void sum_combine_u64(void* into, void* from) {
+    *(u64*) into += *(u64*) from;
+}
+
+void sum_reduce_u32(void* data, u32 count, void* partial) {
+    u32* values = (u32*) data;
+    u32 sum = 0;
+    for (u32 i = 0; i < count; ++i) {
+        sum += values[i];
+    }
+    *(u32*) partial += sum;
+}
+
+void sum_scan(void* in, void* out, u32 count, void* carry, b32 inclusive) {
+    u32* src = (u32*) in;
+    u32* dst = (u32*) out;
+    u32 running = *(u32*) carry;
+    if (inclusive) {
+        for (u32 i = 0; i < count; ++i) {
+            running += src[i];
+            dst[i] = running;
+        }
+    }
+    else {
+        for (u32 i = 0; i < count; ++i) {
+            u32 value = src[i];
+            dst[i] = running;
+            running += value;
+        }
+    }
+    *(u32*) carry = running;
+}
+
+f64 now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64) ts.tv_sec + (f64) ts.tv_nsec * 1e-9;
+}
+
+void fill(u32* values, u64 count) {
+    for (u64 i = 0; i < count; ++i) {
+        values[i] = (u32) (i * 2654435761u) >> 20;
+    }
+}
+
+void run_and_wait(Job* job) {
+    Worker* worker = job_system_thread_worker();
+    JobHandle handle = job_handle(job);
+    worker_submit(worker, job);
+    worker_wait_handle(worker, handle);
+}
+
+void bench_reduce(u32* values, u32 count, Arena* arena) {
+    f64 start = now_seconds();
+    u64 serial = 0;
+    sum_reduce(values, count, &serial);
+    f64 serial_time = now_seconds() - start;
+
+    u64 identity = 0;
+    u64 result = 0;
+    ParallelReduce reduce = {
+        .data = values,
+        .count = count,
+        .element_size = sizeof(u32),
+        .grain_size = 0,
+        .reduce = &sum_reduce,
+        .combine = &sum_combine_u64,
+        .result_size = sizeof(u64),
+        .identity = &identity,
+        .result = &result,
+    };
+
+    TempArena tmp = temp_arena_begin(arena);
+    start = now_seconds();
+    run_and_wait(parallel_reduce(&reduce, arena));
+    f64 parallel_time = now_seconds() - start;
+    temp_arena_end(&tmp);
+
+    printf("reduce         n=%-11u serial=%9.3f ms parallel=%9.3f ms speedup=%5.2fx %s\n", count, serial_time * 1e3,
+           parallel_time * 1e3, serial_time / parallel_time, result == serial ? "" : "MISMATCH");
+}
+
+void bench_scan(u32* values, u32 count, b32 inclusive, Arena* arena) {
+    u32 samples[N_SAMPLES];
+
+    fill(values, count);
+    f64 start = now_seconds();
+    u32 carry = 0;
+    sum_scan(values, values, count, &carry, inclusive);
+    f64 serial_time = now_seconds() - start;
+    for (u32 i = 0; i < N_SAMPLES; ++i) {
+        samples[i] = values[(u64) count * i / N_SAMPLES];
+    }
+
+    fill(values, count);
+    u32 identity = 0;
+    ParallelScan scan = {
+        .in = values,
+        .out = values,
+        .count = count,
+        .element_size = sizeof(u32),
+        .block_size = 0,
+        .inclusive = inclusive,
+        .reduce = &sum_reduce_u32,
+        .combine = &sum_combine,
+        .scan = &sum_scan,
+        .result_size = sizeof(u32),
+        .identity = &identity,
+    };
+
+    TempArena tmp = temp_arena_begin(arena);
+    start = now_seconds();
+    run_and_wait(parallel_scan(&scan, arena));
+    f64 parallel_time = now_seconds() - start;
+    temp_arena_end(&tmp);
+
+    b32 matches = true;
+    for (u32 i = 0; i < N_SAMPLES; ++i) {
+        matches &= samples[i] == values[(u64) count * i / N_SAMPLES];
+    }
+
+    printf("%-14s n=%-11u serial=%9.3f ms parallel=%9.3f ms speedup=%5.2fx %s\n", inclusive ? "scan-inclusive" : "scan-exclusive",
+           count, serial_time * 1e3, parallel_time * 1e3, serial_time / parallel_time, matches ? "" : "MISMATCH");
+}
+
+int main(int argc, char** argv) {
+    u64 max_count = argc > 1 ? (u64) atoll(argv[1]) : (256u << 20);
+    JobSystemOptions options = job_system_default_options();
+    options.n_workers = argc > 2 ? (u32) atoi(argv[2]) : 0;
+    job_system_init_with_options(options);
+
+    Arena arena = arena_create(Megabytes(1));
+    u32* values = (u32*) malloc(max_count * sizeof(u32));
+
+    for (u64 count = 1u << 20; count <= max_count; count *= 16) {
+        fill(values, count);
+        bench_reduce(values, (u32) count, &arena);
+        bench_scan(values, (u32) count, true, &arena);
+        bench_scan(values, (u32) count, false, &arena);
+    }
+
+    free(values);
+    arena_release(&arena);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <core/language_layer.h>
+#include <core/mem.h>
+#include <core/jobs.h>
+
+// NOTE(bryson): bounded multi-producer multi-consumer ring after Vyukov, for passing values between
+// long-lived jobs. Every cell carries a sequence number: cell pos & mask is free for the producer that
+// claimed pos when its sequence is pos, and holds a value for the consumer that claimed pos when it is
+// pos + 1. Producers only contend on tail and consumers on head, which sit on cache lines of their own,
+// and a claimed cell is filled or emptied without holding anything. Values are copied in and out,
+// element_size bytes each.
+//
+// channel_send and channel_recv wait when the channel is full or empty. Like job_system_wait, a job
+// suspends its fiber in the meantime (with use_fibers), otherwise the worker runs other jobs on top of
+// the waiting one. Without fibers a producer and a consumer of the same channel can end up waiting on
+// each other below and above on one stack, so long-lived producer and consumer jobs want fibers.
+typedef struct Channel {
+    byte* cells;
+    u64 mask;
+    u32 element_size;
+    // sequence number plus the value, rounded up to keep the sequences aligned
+    u32 cell_stride;
+    // set once by channel_close
+    b32 closed;
+    byte config_pad[CACHE_SIZE - sizeof(byte*) - sizeof(u64) - 2 * sizeof(u32) - sizeof(b32)];
+    // next position to send to
+    u64 tail;
+    byte tail_pad[CACHE_SIZE - sizeof(u64)];
+    // next position to receive from
+    u64 head;
+    byte head_pad[CACHE_SIZE - sizeof(u64)];
+} Channel;
+
+// Room for capacity values (rounded up to a power of two) of element_size bytes, in the arena.
+Channel* channel_create(Arena* arena, u32 capacity, u32 element_size) {
+    u64 n_cells = 2;
+    while (n_cells < capacity) {
+        n_cells <<= 1;
+    }
+
+    Channel* channel = (Channel*) arena_alloc_align(arena, sizeof(Channel), CACHE_SIZE);
+    Assert(channel != NULL);
+    channel->mask = n_cells - 1;
+    channel->element_size = element_size;
+    channel->cell_stride = (u32) (AlignUpPow2(sizeof(u64) + element_size, sizeof(u64)));
+    channel->cells = arena_alloc_align(arena, channel->cell_stride * n_cells, CACHE_SIZE);
+    Assert(channel->cells != NULL);
+    channel->closed = false;
+    channel->tail = 0;
+    channel->head = 0;
+    for (u64 i = 0; i < n_cells; ++i) {
+        *(u64*) (channel->cells + i * channel->cell_stride) = i;
+    }
+    return channel;
+}
+
+u64* channel_cell(Channel* channel, u64 pos) {
+    return (u64*) (channel->cells + (pos & channel->mask) * channel->cell_stride);
+}
+
+// Returns false right away if the channel is full.
+b32 channel_try_send(Channel* channel, void* value) {
+    Assert(!atomic_load_relaxed(&channel->closed));
+    u64 pos = atomic_load_relaxed(&channel->tail);
+    u64* cell;
+    for (;;) {
+        cell = channel_cell(channel, pos);
+        i64 diff = (i64) (atomic_load_acquire(cell) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&channel->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // the consumer a lap behind hasn't emptied the cell yet
+            return false;
+        }
+        else {
+            pos = atomic_load_relaxed(&channel->tail);
+        }
+    }
+
+    MemoryCopy(cell + 1, value, channel->element_size);
+    atomic_store_release(cell, pos + 1);
+    return true;
+}
+
+// Returns false right away if the channel is empty.
+b32 channel_try_recv(Channel* channel, void* value) {
+    u64 pos = atomic_load_relaxed(&channel->head);
+    u64* cell;
+    for (;;) {
+        cell = channel_cell(channel, pos);
+        i64 diff = (i64) (atomic_load_acquire(cell) - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&channel->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // nothing sent to pos yet, or the producer that claimed it is still copying
+            return false;
+        }
+        else {
+            pos = atomic_load_relaxed(&channel->head);
+        }
+    }
+
+    MemoryCopy(value, cell + 1, channel->element_size);
+    // free for the producer one lap ahead
+    atomic_store_release(cell, pos + channel->mask + 1);
+    return true;
+}
+
+b32 channel_send_ready(void* arg) {
+    Channel* channel = (Channel*) arg;
+    u64 pos = atomic_load_relaxed(&channel->tail);
+    return atomic_load_acquire(channel_cell(channel, pos)) == pos;
+}
+
+b32 channel_recv_ready(void* arg) {
+    Channel* channel = (Channel*) arg;
+    u64 pos = atomic_load_relaxed(&channel->head);
+    return atomic_load_acquire(channel_cell(channel, pos)) == pos + 1 || atomic_load_acquire(&channel->closed);
+}
+
+// Waits while the channel is full.
+void channel_send(Channel* channel, void* value) {
+    while (!channel_try_send(channel, value)) {
+        job_system_wait_until(&channel_send_ready, channel);
+    }
+}
+
+// Waits while the channel is empty. Returns false once the channel was closed and every value in it
+// was received.
+b32 channel_recv(Channel* channel, void* value) {
+    for (;;) {
+        if (channel_try_recv(channel, value)) {
+            return true;
+        }
+        if (atomic_load_acquire(&channel->closed)) {
+            // values sent before the close are visible now
+            return channel_try_recv(channel, value);
+        }
+        job_system_wait_until(&channel_recv_ready, channel);
+    }
+}
+
+// No more sends, receivers drain what is left and then get false. Call it once every producer is done.
+void channel_close(Channel* channel) {
+    atomic_store_release(&channel->closed, true);
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "language_layer.h"
+#include "mem.h"
+
+// NOTE(bryson): minimal stackful fibers. Only the callee-saved registers are swapped, everything else
+// is saved by the compiler around the call to fiber_switch like any other function call.
+#if OS_LINUX && (ARCH_X64 || ARCH_ARM64)
+#define FIBER_SUPPORTED 1
+#else
+#define FIBER_SUPPORTED 0
+#endif
+
+#define FIBER_DEFAULT_STACK_SIZE Kilobytes(64)
+
+#if !defined(MAP_STACK)
+#define MAP_STACK 0
+#endif
+
+typedef void (*FiberFunc)(void*);
+
+typedef struct Fiber {
+    // saved stack pointer while the fiber is switched out
+    void* sp;
+    byte* stack;
+    u64 stack_size;
+    FiberFunc function;
+    void* arg;
+} Fiber;
+
+// saves the callee-saved registers on the current stack, stores the stack pointer into *from_sp
+// and resumes the context saved at to_sp
+void fiber_switch(void** from_sp, void* to_sp);
+void fiber_entry(void);
+
+#if FIBER_SUPPORTED && ARCH_X64
+// callee-saved: rbx, rbp, r12-r15. A new fiber starts in fiber_entry with the function in r12 and
+// its argument in r13.
+__asm__(
+    ".text\n"
+    ".globl fiber_switch\n"
+    ".type fiber_switch,@function\n"
+    "fiber_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size fiber_switch,.-fiber_switch\n"
+    ".globl fiber_entry\n"
+    ".type fiber_entry,@function\n"
+    "fiber_entry:\n"
+    "    movq %r13, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+    ".size fiber_entry,.-fiber_entry\n"
+);
+
+#define FIBER_FRAME_SIZE (7 * sizeof(void*))
+
+void fiber_init_frame(Fiber* fiber) {
+    void** top = (void**) (fiber->stack + fiber->stack_size);
+    void** frame = (void**) ((byte*) top - FIBER_FRAME_SIZE);
+    frame[0] = NULL;                    // r15
+    frame[1] = NULL;                    // r14
+    frame[2] = fiber->arg;              // r13
+    frame[3] = (void*) fiber->function; // r12
+    frame[4] = NULL;                    // rbx
+    frame[5] = NULL;                    // rbp
+    frame[6] = (void*) &fiber_entry;    // return address
+    fiber->sp = frame;
+}
+#elif FIBER_SUPPORTED && ARCH_ARM64
+// callee-saved: x19-x28, fp, lr and the low halves of v8-v15. A new fiber starts in fiber_entry with
+// the function in x19 and its argument in x20.
+__asm__(
+    ".text\n"
+    ".globl fiber_switch\n"
+    ".type fiber_switch,%function\n"
+    "fiber_switch:\n"
+    "    sub sp, sp, #0xa0\n"
+    "    stp x19, x20, [sp, #0x00]\n"
+    "    stp x21, x22, [sp, #0x10]\n"
+    "    stp x23, x24, [sp, #0x20]\n"
+    "    stp x25, x26, [sp, #0x30]\n"
+    "    stp x27, x28, [sp, #0x40]\n"
+    "    stp x29, x30, [sp, #0x50]\n"
+    "    stp d8, d9, [sp, #0x60]\n"
+    "    stp d10, d11, [sp, #0x70]\n"
+    "    stp d12, d13, [sp, #0x80]\n"
+    "    stp d14, d15, [sp, #0x90]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0x00]\n"
+    "    ldp x21, x22, [sp, #0x10]\n"
+    "    ldp x23, x24, [sp, #0x20]\n"
+    "    ldp x25, x26, [sp, #0x30]\n"
+    "    ldp x27, x28, [sp, #0x40]\n"
+    "    ldp x29, x30, [sp, #0x50]\n"
+    "    ldp d8, d9, [sp, #0x60]\n"
+    "    ldp d10, d11, [sp, #0x70]\n"
+    "    ldp d12, d13, [sp, #0x80]\n"
+    "    ldp d14, d15, [sp, #0x90]\n"
+    "    add sp, sp, #0xa0\n"
+    "    ret\n"
+    ".size fiber_switch,.-fiber_switch\n"
+    ".globl fiber_entry\n"
+    ".type fiber_entry,%function\n"
+    "fiber_entry:\n"
+    "    mov x0, x20\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size fiber_entry,.-fiber_entry\n"
+);
+
+#define FIBER_FRAME_SIZE 0xa0
+
+void fiber_init_frame(Fiber* fiber) {
+    void** top = (void**) (fiber->stack + fiber->stack_size);
+    void** frame = (void**) ((byte*) top - FIBER_FRAME_SIZE);
+    MemoryZero(frame, FIBER_FRAME_SIZE);
+    frame[0] = (void*) fiber->function; // x19
+    frame[1] = fiber->arg;              // x20
+    frame[11] = (void*) &fiber_entry;   // x30
+    fiber->sp = frame;
+}
+#else
+void fiber_switch(void** from_sp, void* to_sp) {
+    Assert(!"fibers are not supported on this platform");
+}
+
+void fiber_entry(void) {}
+
+void fiber_init_frame(Fiber* fiber) {
+    Assert(!"fibers are not supported on this platform");
+}
+#endif
+
+// Allocates a stack with a guard page below it. The function must never return, switch away instead.
+Fiber fiber_create(u64 stack_size, FiberFunc function, void* arg) {
+    u64 page_size = (u64) sysconf(_SC_PAGESIZE);
+    stack_size = AlignUpPow2(stack_size, page_size);
+
+    byte* mapping = (byte*) mmap(NULL, stack_size + page_size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    Assert(mapping != MAP_FAILED);
+    mprotect(mapping, page_size, PROT_NONE);
+
+    Fiber fiber = {
+        .sp = NULL,
+        .stack = mapping + page_size,
+        .stack_size = stack_size,
+        .function = function,
+        .arg = arg,
+    };
+    if (function != NULL) {
+        fiber_init_frame(&fiber);
+    }
+    return fiber;
+}
+
+// restarts a fiber that is not running from the top of its stack
+void fiber_reset(Fiber* fiber, FiberFunc function, void* arg) {
+    fiber->function = function;
+    fiber->arg = arg;
+    fiber_init_frame(fiber);
+}
+
+void fiber_release(Fiber* fiber) {
+    u64 page_size = (u64) sysconf(_SC_PAGESIZE);
+    munmap(fiber->stack - page_size, fiber->stack_size + page_size);
+    MemoryZeroStruct(fiber);
+}
+
+// the thread's own stack, its context is filled in on the first switch away from it
+Fiber fiber_from_thread() {
+    Fiber fiber = {0};
+    return fiber;
+}
+
+void fiber_switch_to(Fiber* from, Fiber* to) {
+    fiber_switch(&from->sp, to->sp);
+}
+
+#pragma region fiber_pool
+// NOTE(bryson): single-threaded pool of preallocated fibers, a fiber is handed out with a fresh frame
+typedef struct FiberPool {
+    Fiber* fibers;
+    Fiber** free;
+    u32 n_free;
+    u32 n_fibers;
+} FiberPool;
+
+FiberPool fiber_pool_create(Arena* arena, u32 n_fibers, u64 stack_size) {
+    FiberPool pool = {
+        .fibers = arena_push_array(arena, Fiber, n_fibers),
+        .free = arena_push_array(arena, Fiber*, n_fibers),
+        .n_free = n_fibers,
+        .n_fibers = n_fibers,
+    };
+    for (u32 i = 0; i < n_fibers; ++i) {
+        pool.fibers[i] = fiber_create(stack_size, NULL, NULL);
+        pool.free[i] = &pool.fibers[i];
+    }
+    return pool;
+}
+
+// returns NULL when every fiber is in use
+Fiber* fiber_pool_acquire(FiberPool* pool, FiberFunc function, void* arg) {
+    if (pool->n_free == 0) {
+        return NULL;
+    }
+    Fiber* fiber = pool->free[--pool->n_free];
+    fiber_reset(fiber, function, arg);
+    return fiber;
+}
+
+void fiber_pool_release(FiberPool* pool, Fiber* fiber) {
+    Assert(pool->n_free < pool->n_fibers);
+    pool->free[pool->n_free++] = fiber;
+}
+#pragma endregion
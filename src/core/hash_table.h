@@ -24,6 +24,8 @@ typedef struct HashTable {
     Arena* arena;
     HashNode** slots;
     u64 slot_count;
+    // optional, nodes come from here instead of the arena and hash_table_remove gives them back
+    Pool* node_pool;
 } HashTable;
 
 HashTable hash_table_create(Arena* arena, u64 slot_count) {
@@ -31,10 +33,19 @@ HashTable hash_table_create(Arena* arena, u64 slot_count) {
         .arena = arena,
         .slots = arena_push_array(arena, HashNode*, slot_count),
         .slot_count = slot_count,
+        .node_pool = NULL,
     };
     return ht;
 }
 
+// For tables whose keys come and go. node_pool holds HashNodes, see pool_create_typed.
+HashTable hash_table_create_pooled(Arena* arena, u64 slot_count, Pool* node_pool) {
+    Assert(node_pool->element_size >= sizeof(HashNode));
+    HashTable ht = hash_table_create(arena, slot_count);
+    ht.node_pool = node_pool;
+    return ht;
+}
+
 byte* hash_table_get(HashTable* ht, char* key) {
     byte* result = NULL;
 
@@ -68,7 +79,8 @@ void hash_table_insert(HashTable* ht, char* key, byte* value) {
     }
 
     if (existing_node == NULL) {
-        HashNode* new_node = arena_push(ht->arena, HashNode);
+        HashNode* new_node = ht->node_pool ? pool_push_no_zero(ht->node_pool, HashNode) : arena_push_no_zero(ht->arena, HashNode);
+        Assert(new_node != NULL);
         new_node->key = key;
 
         new_node->value = value;
@@ -82,6 +94,24 @@ void hash_table_insert(HashTable* ht, char* key, byte* value) {
     }
 }
 
+// Returns false if the key wasn't in the table. Without a node pool the node's memory stays in the arena.
+b32 hash_table_remove(HashTable* ht, char* key) {
+    u64 hash = hash_string(key);
+    u64 slot_idx = hash % ht->slot_count;
+
+    for (HashNode** link = &ht->slots[slot_idx]; *link != NULL; link = &(*link)->next) {
+        HashNode* node = *link;
+        if (node->hash == hash) {
+            *link = node->next;
+            if (ht->node_pool != NULL) {
+                pool_free(ht->node_pool, node);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
 typedef struct HashSet {
     HashTable ht;
 } HashSet;
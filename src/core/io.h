@@ -0,0 +1,484 @@
+#pragma once
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__gnu_linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#include <core/language_layer.h>
+#include <core/mem.h>
+#include <core/jobs.h>
+
+// NOTE(bryson): asynchronous reads, writes and fsyncs for jobs. A job fills in an IoRequest, names the
+// job to continue with once it completed and returns instead of blocking its worker. Requests go to
+// io_uring where the kernel has it and a poller thread turns completions into submitted continuations,
+// which workers pick up from the injection queue like any other job. Without io_uring (old kernels,
+// seccomp sandboxes) a few blocking threads run the requests instead.
+#if defined(__gnu_linux__) && defined(__NR_io_uring_setup)
+#define IO_URING_SUPPORTED 1
+#else
+#define IO_URING_SUPPORTED 0
+#endif
+
+// reads and writes at the file position, and the only offset sockets and pipes accept
+#define IO_OFFSET_NONE ULLONG_MAX
+
+typedef enum IoOp {
+    IO_OP_READ,
+    IO_OP_WRITE,
+    IO_OP_FSYNC,
+} IoOp;
+
+typedef enum IoBackend {
+    IO_BACKEND_NONE,
+    IO_BACKEND_URING,
+    IO_BACKEND_BLOCKING,
+} IoBackend;
+
+// one buffer of the pool, registered with the ring so the kernel doesn't map it on every request
+typedef struct IoBuffer {
+    byte* data;
+    u64 capacity;
+    // index in the registered buffer table
+    u32 index;
+} IoBuffer;
+
+// NOTE(bryson): owned by the caller and must stay put until the continuation runs, so keep it in
+// something that outlives the submitting job (its parent's data, an arena, the continuation's payload).
+typedef struct IoRequest {
+    IoOp op;
+    i32 fd;
+    IoBuffer* buffer;
+    // bytes to read or write, from the start of the buffer
+    u64 size;
+    u64 offset;
+    // submitted once the request completed, may be NULL
+    Job* continuation;
+    // bytes transferred (possibly short) or -errno, valid once the continuation runs
+    i64 result;
+    // link in the blocking backend's queue
+    struct IoRequest* next;
+} IoRequest;
+
+typedef struct IoOptions {
+    // entries in the submission queue. Twice as many requests may be in flight, more wait for room.
+    u32 queue_depth;
+    u32 n_buffers;
+    u64 buffer_size;
+    // threads running requests when io_uring isn't available
+    u32 n_blocking_threads;
+    // skip io_uring even if the kernel has it
+    b32 force_blocking;
+} IoOptions;
+
+static struct {
+    IoBackend backend;
+    Arena arena;
+
+    IoBuffer* buffers;
+    IoBuffer** free_buffers;
+    u32 n_free_buffers;
+    u32 n_buffers;
+    b32 buffers_registered;
+    pthread_mutex_t buffer_lock;
+
+#if IO_URING_SUPPORTED
+    i32 ring_fd;
+    u32 sq_entries;
+    u32 cq_entries;
+    u32* sq_head;
+    u32* sq_tail;
+    u32 sq_mask;
+    u32* sq_array;
+    struct io_uring_sqe* sqes;
+    u32* cq_head;
+    u32* cq_tail;
+    u32 cq_mask;
+    struct io_uring_cqe* cqes;
+    // requests handed to the kernel and not reaped yet
+    i32 in_flight;
+    pthread_mutex_t submit_lock;
+#endif
+
+    IoRequest* queue_head;
+    IoRequest* queue_tail;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+} _io;
+
+IoOptions io_default_options() {
+    IoOptions options = {
+        .queue_depth = 256,
+        .n_buffers = 64,
+        .buffer_size = Kilobytes(64),
+        .n_blocking_threads = 4,
+        .force_blocking = false,
+    };
+    return options;
+}
+
+void io_complete(IoRequest* request, i64 result) {
+    request->result = result;
+    // the continuation may free the request as soon as it runs
+    Job* continuation = request->continuation;
+    if (continuation != NULL) {
+        job_system_submit(continuation);
+    }
+}
+
+#pragma region io_buffers
+void io_buffers_init(u32 n_buffers, u64 buffer_size) {
+    buffer_size = AlignUpPow2(buffer_size, (u64) sysconf(_SC_PAGESIZE));
+    byte* memory = (byte*) mmap(NULL, buffer_size * n_buffers, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(memory != MAP_FAILED);
+
+    _io.n_buffers = n_buffers;
+    _io.n_free_buffers = n_buffers;
+    _io.buffers = arena_push_array(&_io.arena, IoBuffer, n_buffers);
+    _io.free_buffers = arena_push_array(&_io.arena, IoBuffer*, n_buffers);
+    for (u32 i = 0; i < n_buffers; ++i) {
+        _io.buffers[i].data = memory + buffer_size * i;
+        _io.buffers[i].capacity = buffer_size;
+        _io.buffers[i].index = i;
+        // handed out from the back, lowest index first
+        _io.free_buffers[i] = &_io.buffers[n_buffers - 1 - i];
+    }
+    pthread_mutex_init(&_io.buffer_lock, NULL);
+}
+
+// Returns NULL when every buffer is in use.
+IoBuffer* io_buffer_acquire() {
+    IoBuffer* buffer = NULL;
+    pthread_mutex_lock(&_io.buffer_lock);
+    if (_io.n_free_buffers > 0) {
+        buffer = _io.free_buffers[--_io.n_free_buffers];
+    }
+    pthread_mutex_unlock(&_io.buffer_lock);
+    return buffer;
+}
+
+void io_buffer_release(IoBuffer* buffer) {
+    pthread_mutex_lock(&_io.buffer_lock);
+    Assert(_io.n_free_buffers < _io.n_buffers);
+    _io.free_buffers[_io.n_free_buffers++] = buffer;
+    pthread_mutex_unlock(&_io.buffer_lock);
+}
+#pragma endregion
+
+#pragma region io_uring
+#if IO_URING_SUPPORTED
+// NOTE(bryson): no liburing, just the three syscalls. Submitters take turns on the submission queue and
+// enter right away, so without SQPOLL the kernel has consumed every entry by the time the lock is
+// released. The poller thread is the only consumer of the completion queue.
+i32 io_uring_enter(u32 to_submit, u32 min_complete, u32 flags) {
+    return (i32) syscall(__NR_io_uring_enter, _io.ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Registering pins the buffers, which can fail on a low RLIMIT_MEMLOCK. Requests then use the plain
+// read and write ops on the same buffers.
+void io_uring_register_buffers(i32 fd) {
+    struct iovec* iovecs = arena_push_array(&_io.arena, struct iovec, _io.n_buffers);
+    for (u32 i = 0; i < _io.n_buffers; ++i) {
+        iovecs[i].iov_base = _io.buffers[i].data;
+        iovecs[i].iov_len = _io.buffers[i].capacity;
+    }
+    _io.buffers_registered = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs, _io.n_buffers) == 0;
+}
+
+// The plain read and write ops only exist since 5.6, the same kernel that added probing. Where probing
+// fails the ring can still be set up, but only the _FIXED ops work.
+b32 io_uring_supports_plain_ops(i32 fd) {
+    u64 probe_size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    TempArena tmp = temp_arena_begin(&_io.arena);
+    struct io_uring_probe* probe = (struct io_uring_probe*) arena_alloc(&_io.arena, probe_size);
+    b32 supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+    u8 ops[] = {IORING_OP_READ, IORING_OP_WRITE};
+    for (u32 i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); ++i) {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    temp_arena_end(&tmp);
+    return supported;
+}
+
+// unmaps whatever did map and closes the ring, the caller falls back to the blocking threads
+void io_uring_release(i32 fd, byte* sq, u64 sq_size, byte* cq, u64 cq_size, byte* sqes, u64 sqes_size) {
+    if (sq != MAP_FAILED) {
+        munmap(sq, sq_size);
+    }
+    if (cq != sq && cq != MAP_FAILED) {
+        munmap(cq, cq_size);
+    }
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqes_size);
+    }
+    close(fd);
+}
+
+// Returns false where io_uring can't run every request: no io_uring at all, or a kernel older than 5.6
+// when the buffers couldn't be registered either.
+b32 io_uring_init(u32 queue_depth) {
+    struct io_uring_params params;
+    MemoryZeroStruct(&params);
+    i32 fd = (i32) syscall(__NR_io_uring_setup, queue_depth, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    u64 sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    u64 cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    u64 sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    b32 single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        sq_size = cq_size = Max(sq_size, cq_size);
+    }
+
+    byte* sq = (byte*) mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    byte* cq = single_mmap ? sq : (byte*) mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    byte* sqes = (byte*) mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        io_uring_release(fd, sq, sq_size, cq, cq_size, sqes, sqes_size);
+        return false;
+    }
+
+    io_uring_register_buffers(fd);
+    if (!_io.buffers_registered && !io_uring_supports_plain_ops(fd)) {
+        io_uring_release(fd, sq, sq_size, cq, cq_size, sqes, sqes_size);
+        return false;
+    }
+
+    _io.ring_fd = fd;
+    _io.sq_entries = params.sq_entries;
+    _io.cq_entries = params.cq_entries;
+    _io.sq_head = (u32*) (sq + params.sq_off.head);
+    _io.sq_tail = (u32*) (sq + params.sq_off.tail);
+    _io.sq_mask = *(u32*) (sq + params.sq_off.ring_mask);
+    _io.sq_array = (u32*) (sq + params.sq_off.array);
+    _io.sqes = (struct io_uring_sqe*) sqes;
+    _io.cq_head = (u32*) (cq + params.cq_off.head);
+    _io.cq_tail = (u32*) (cq + params.cq_off.tail);
+    _io.cq_mask = *(u32*) (cq + params.cq_off.ring_mask);
+    _io.cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    _io.in_flight = 0;
+    pthread_mutex_init(&_io.submit_lock, NULL);
+    return true;
+}
+
+void io_uring_submit(IoRequest* request) {
+    // the completion queue may not overflow, so past its size submitters wait for the poller
+    while (atomic_increment(&_io.in_flight) >= (i32) _io.cq_entries) {
+        atomic_decrement(&_io.in_flight);
+        yield();
+    }
+
+    pthread_mutex_lock(&_io.submit_lock);
+    u32 tail = *_io.sq_tail;
+    u32 index = tail & _io.sq_mask;
+    struct io_uring_sqe* sqe = &_io.sqes[index];
+    MemoryZeroStruct(sqe);
+    sqe->fd = request->fd;
+    sqe->user_data = (u64) request;
+    if (request->op == IO_OP_FSYNC) {
+        sqe->opcode = IORING_OP_FSYNC;
+    }
+    else {
+        b32 write = request->op == IO_OP_WRITE;
+        if (_io.buffers_registered) {
+            sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->buf_index = (u16) request->buffer->index;
+        }
+        else {
+            sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        }
+        sqe->addr = (u64) request->buffer->data;
+        sqe->len = (u32) request->size;
+        sqe->off = request->offset;
+    }
+    _io.sq_array[index] = index;
+    atomic_store_release(_io.sq_tail, tail + 1);
+
+    i32 submitted = io_uring_enter(1, 0, 0);
+    while (submitted < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+        yield();
+        submitted = io_uring_enter(1, 0, 0);
+    }
+    if (submitted == 1) {
+        pthread_mutex_unlock(&_io.submit_lock);
+        return;
+    }
+
+    // ENOMEM, EBADF and the like. Without SQPOLL the kernel only takes entries inside io_uring_enter, so
+    // an entry it didn't take can be pulled back out and the request fails through the usual completion.
+    i64 error = submitted < 0 ? -errno : -EIO;
+    b32 taken = atomic_load_acquire(_io.sq_head) != tail;
+    if (!taken) {
+        atomic_store_release(_io.sq_tail, tail);
+    }
+    pthread_mutex_unlock(&_io.submit_lock);
+    if (!taken) {
+        atomic_decrement(&_io.in_flight);
+        io_complete(request, error);
+    }
+}
+
+void* io_uring_poller_proc(void* arg) {
+    for (;;) {
+        // EINTR and friends just go around again
+        io_uring_enter(0, 1, IORING_ENTER_GETEVENTS);
+
+        u32 head = *_io.cq_head;
+        u32 tail = atomic_load_acquire(_io.cq_tail);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe* cqe = &_io.cqes[head & _io.cq_mask];
+            IoRequest* request = (IoRequest*) cqe->user_data;
+            i64 result = cqe->res;
+            atomic_store_release(_io.cq_head, head + 1);
+            atomic_decrement(&_io.in_flight);
+            io_complete(request, result);
+        }
+    }
+    return NULL;
+}
+#endif
+#pragma endregion
+
+#pragma region io_blocking
+i64 io_blocking_run(IoRequest* request) {
+    for (;;) {
+        ssize_t result = 0;
+        byte* data = request->buffer ? request->buffer->data : NULL;
+        switch (request->op) {
+            case IO_OP_READ:
+                result = request->offset == IO_OFFSET_NONE ? read(request->fd, data, request->size)
+                                                           : pread(request->fd, data, request->size, (off_t) request->offset);
+                break;
+            case IO_OP_WRITE:
+                result = request->offset == IO_OFFSET_NONE ? write(request->fd, data, request->size)
+                                                           : pwrite(request->fd, data, request->size, (off_t) request->offset);
+                break;
+            case IO_OP_FSYNC:
+                result = fsync(request->fd);
+                break;
+        }
+        if (result >= 0) {
+            return result;
+        }
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+void* io_blocking_proc(void* arg) {
+    for (;;) {
+        pthread_mutex_lock(&_io.queue_lock);
+        while (_io.queue_head == NULL) {
+            pthread_cond_wait(&_io.queue_cond, &_io.queue_lock);
+        }
+        IoRequest* request = _io.queue_head;
+        _io.queue_head = request->next;
+        if (_io.queue_head == NULL) {
+            _io.queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&_io.queue_lock);
+
+        io_complete(request, io_blocking_run(request));
+    }
+    return NULL;
+}
+
+void io_blocking_submit(IoRequest* request) {
+    request->next = NULL;
+    pthread_mutex_lock(&_io.queue_lock);
+    if (_io.queue_tail != NULL) {
+        _io.queue_tail->next = request;
+    }
+    else {
+        _io.queue_head = request;
+    }
+    _io.queue_tail = request;
+    pthread_cond_signal(&_io.queue_cond);
+    pthread_mutex_unlock(&_io.queue_lock);
+}
+#pragma endregion
+
+#pragma region io
+// Call after job_system_init. Returns the backend requests will go to.
+IoBackend io_init_with_options(IoOptions options) {
+    _io.arena = arena_create(Kilobytes(64));
+    io_buffers_init(options.n_buffers, options.buffer_size);
+
+    pthread_t thread_id;
+#if IO_URING_SUPPORTED
+    if (!options.force_blocking && io_uring_init(options.queue_depth)) {
+        _io.backend = IO_BACKEND_URING;
+        pthread_create(&thread_id, &_job_system.thread_attr, io_uring_poller_proc, NULL);
+        pthread_detach(thread_id);
+        return _io.backend;
+    }
+#endif
+
+    _io.backend = IO_BACKEND_BLOCKING;
+    pthread_mutex_init(&_io.queue_lock, NULL);
+    pthread_cond_init(&_io.queue_cond, NULL);
+    for (u32 i = 0; i < ClampBot(options.n_blocking_threads, 1); ++i) {
+        pthread_create(&thread_id, &_job_system.thread_attr, io_blocking_proc, NULL);
+        pthread_detach(thread_id);
+    }
+    return _io.backend;
+}
+
+IoBackend io_init() {
+    return io_init_with_options(io_default_options());
+}
+
+// Starts the request and returns right away. Can be called from any thread, the continuation is
+// submitted once the request completed.
+void io_submit(IoRequest* request) {
+    Assert(_io.backend != IO_BACKEND_NONE);
+    Assert(request->op == IO_OP_FSYNC || (request->buffer != NULL && request->size <= request->buffer->capacity));
+    request->result = 0;
+#if IO_URING_SUPPORTED
+    if (_io.backend == IO_BACKEND_URING) {
+        io_uring_submit(request);
+        return;
+    }
+#endif
+    io_blocking_submit(request);
+}
+
+void io_read(IoRequest* request, i32 fd, IoBuffer* buffer, u64 size, u64 offset, Job* continuation) {
+    request->op = IO_OP_READ;
+    request->fd = fd;
+    request->buffer = buffer;
+    request->size = size;
+    request->offset = offset;
+    request->continuation = continuation;
+    io_submit(request);
+}
+
+void io_write(IoRequest* request, i32 fd, IoBuffer* buffer, u64 size, u64 offset, Job* continuation) {
+    request->op = IO_OP_WRITE;
+    request->fd = fd;
+    request->buffer = buffer;
+    request->size = size;
+    request->offset = offset;
+    request->continuation = continuation;
+    io_submit(request);
+}
+
+void io_fsync(IoRequest* request, i32 fd, Job* continuation) {
+    request->op = IO_OP_FSYNC;
+    request->fd = fd;
+    request->buffer = NULL;
+    request->size = 0;
+    request->offset = 0;
+    request->continuation = continuation;
+    io_submit(request);
+}
+#pragma endregion
@@ -1,19 +1,45 @@
+#pragma once
+
 #include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <sched.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdatomic.h>
+#include <limits.h>
+#include <errno.h>
+
+#if defined(__gnu_linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #include <core/language_layer.h>
 #include <core/rand.h>
 #include <core/mem.h>
+#include <core/topology.h>
+#include <core/fiber.h>
 
 #define atomic_increment(pval) __atomic_fetch_add(pval, 1, __ATOMIC_SEQ_CST)
 #define atomic_decrement(pval) __atomic_fetch_sub(pval, 1, __ATOMIC_SEQ_CST)
 #define atomic_compare_exchange(pval,pexpected,desired)__atomic_compare_exchange_n(pval, pexpected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define atomic_load_relaxed(pval) __atomic_load_n(pval, __ATOMIC_RELAXED)
+#define atomic_load_acquire(pval) __atomic_load_n(pval, __ATOMIC_ACQUIRE)
+#define atomic_store_relaxed(pval,val) __atomic_store_n(pval, val, __ATOMIC_RELAXED)
+#define atomic_store_release(pval,val) __atomic_store_n(pval, val, __ATOMIC_RELEASE)
+#define atomic_fence_release() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define atomic_fence_seq_cst() __atomic_thread_fence(__ATOMIC_SEQ_CST)
 #define yield() sched_yield()
 
+#if ARCH_X64 || ARCH_X86
+#define cpu_relax() __builtin_ia32_pause()
+#elif ARCH_ARM64 || ARCH_ARM
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax()
+#endif
+
 #define MAX_JOB_COUNT 256
 #define MOD_MASK (MAX_JOB_COUNT - 1)
 
@@ -33,347 +59,3244 @@ int get_available_cores() {
 size_t get_cache_line_size() {
     size_t line_size = 0;
 #if defined(_WIN32) || defined(_WIN64)
-#else
+#elif defined(__APPLE__)
 #include<sys/sysctl.h>
     line_size = 0;
     size_t len = sizeof(line_size);
     sysctlbyname("hw.cachelinesize", &line_size, &len, 0, 0);
+#else
+    line_size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
 #endif
     return line_size;
 }
 
+#pragma region clock
+// NOTE(bryson): ticks are the cheapest timestamp the cpu has (the tsc on x86, the monotonic clock
+// elsewhere). They are only turned into nanoseconds when somebody reads them, using the ratio between
+// ticks and the monotonic clock since job_clock_init.
+#if ARCH_X64 || ARCH_X86
+#include <x86intrin.h>
+#endif
+#include <time.h>
+
+static struct {
+    u64 start_ticks;
+    u64 start_ns;
+} _job_clock;
+
+u64 job_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000000000ull + (u64) ts.tv_nsec;
+}
+
+u64 job_clock_ticks() {
+#if ARCH_X64 || ARCH_X86
+    return __rdtsc();
+#else
+    return job_clock_ns();
+#endif
+}
+
+void job_clock_init() {
+    _job_clock.start_ticks = job_clock_ticks();
+    _job_clock.start_ns = job_clock_ns();
+}
+
+// deadline ns from now for pthread_cond_timedwait, which waits on the realtime clock
+struct timespec job_clock_deadline(u64 ns) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    u64 deadline_ns = (u64) deadline.tv_nsec + ns;
+    deadline.tv_sec += (time_t) (deadline_ns / 1000000000ull);
+    deadline.tv_nsec = (long) (deadline_ns % 1000000000ull);
+    return deadline;
+}
+
+f64 job_clock_ns_per_tick() {
+#if ARCH_X64 || ARCH_X86
+    u64 ticks = job_clock_ticks() - _job_clock.start_ticks;
+    u64 ns = job_clock_ns() - _job_clock.start_ns;
+    return ticks ? (f64) ns / (f64) ticks : 1.0;
+#else
+    return 1.0;
+#endif
+}
+#pragma endregion
+
+#pragma region trace
+// NOTE(bryson): opt-in scheduler tracing, build with JOB_TRACE=1. Every worker appends fixed size
+// events to its own ring buffer, so recording is a couple of stores and a release on the write index.
+// Once the ring is full the oldest events are overwritten. job_trace_dump writes every ring out as
+// Chrome trace JSON (chrome://tracing, ui.perfetto.dev). With JOB_TRACE=0 the hooks compile to nothing.
+#if !defined(JOB_TRACE)
+#define JOB_TRACE 0
+#endif
+
+#define JOB_TRACE_CAPACITY (1u << 16)
+#define JOB_TRACE_MASK (JOB_TRACE_CAPACITY - 1)
+
+typedef enum JobTraceEventType {
+    JOB_TRACE_JOB_BEGIN,
+    JOB_TRACE_JOB_END,
+    JOB_TRACE_STEAL,
+    JOB_TRACE_PARK,
+    JOB_TRACE_UNPARK,
+    JOB_TRACE_SUBMIT_RETRY,
+} JobTraceEventType;
+
+typedef struct JobTraceEvent {
+    u64 timestamp;
+    // job function for job events, victim worker for steals
+    u64 arg;
+    u32 type;
+    // 1 if a steal got a job
+    u32 result;
+} JobTraceEvent;
+
+typedef struct JobTraceBuffer {
+    u64 head;
+    u32 worker;
+    JobTraceEvent* events;
+} JobTraceBuffer;
+
+#if JOB_TRACE
+static struct {
+    JobTraceBuffer* buffers;
+    u32 n_buffers;
+} _job_trace;
+
+thread_local JobTraceBuffer* g_thread_trace = NULL;
+
+void job_trace_init(Arena* arena, u32 n_buffers) {
+    _job_trace.n_buffers = n_buffers;
+    _job_trace.buffers = arena_push_array(arena, JobTraceBuffer, n_buffers);
+    for (u32 i = 0; i < n_buffers; ++i) {
+        _job_trace.buffers[i].head = 0;
+        _job_trace.buffers[i].worker = i;
+        _job_trace.buffers[i].events = (JobTraceEvent*) malloc(sizeof(JobTraceEvent) * JOB_TRACE_CAPACITY);
+    }
+}
+
+void job_trace_thread_init(u32 worker) {
+    g_thread_trace = &_job_trace.buffers[worker];
+}
+
+void job_trace_event(JobTraceEventType type, u64 arg, u32 result) {
+    JobTraceBuffer* buffer = g_thread_trace;
+    if (buffer == NULL) {
+        return;
+    }
+    u64 head = buffer->head;
+    JobTraceEvent* event = &buffer->events[head & JOB_TRACE_MASK];
+    event->timestamp = job_clock_ticks();
+    event->arg = arg;
+    event->type = type;
+    event->result = result;
+    atomic_store_release(&buffer->head, head + 1);
+}
+
+// Writes every worker's events to path as Chrome trace JSON. Events recorded while dumping may be torn,
+// dump once the workers are quiet.
+b32 job_trace_dump(char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    f64 ns_per_tick = job_clock_ns_per_tick();
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    b32 first = true;
+    for (u32 i = 0; i < _job_trace.n_buffers; ++i) {
+        JobTraceBuffer* buffer = &_job_trace.buffers[i];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}",
+                first ? "" : ",\n", buffer->worker, buffer->worker);
+        first = false;
+
+        u64 head = atomic_load_acquire(&buffer->head);
+        u64 start = head > JOB_TRACE_CAPACITY ? head - JOB_TRACE_CAPACITY : 0;
+        for (u64 e = start; e < head; ++e) {
+            JobTraceEvent* event = &buffer->events[e & JOB_TRACE_MASK];
+            f64 ts = (f64) (i64) (event->timestamp - _job_clock.start_ticks) * ns_per_tick / 1000.0;
+
+            switch (event->type) {
+                case JOB_TRACE_JOB_BEGIN:
+                case JOB_TRACE_JOB_END: {
+                    fprintf(file, ",\n{\"name\":\"job\",\"cat\":\"job\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"function\":\"%p\"}}",
+                            event->type == JOB_TRACE_JOB_BEGIN ? "B" : "E", ts, buffer->worker, (void*) event->arg);
+                } break;
+                case JOB_TRACE_PARK:
+                case JOB_TRACE_UNPARK: {
+                    fprintf(file, ",\n{\"name\":\"parked\",\"cat\":\"park\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                            event->type == JOB_TRACE_PARK ? "B" : "E", ts, buffer->worker);
+                } break;
+                case JOB_TRACE_STEAL: {
+                    fprintf(file, ",\n{\"name\":\"steal\",\"cat\":\"steal\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"victim\":%llu,\"success\":%u}}",
+                            ts, buffer->worker, (unsigned long long) event->arg, event->result);
+                } break;
+                case JOB_TRACE_SUBMIT_RETRY: {
+                    fprintf(file, ",\n{\"name\":\"submit_retry\",\"cat\":\"submit\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                            ts, buffer->worker);
+                } break;
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
+#define job_trace(type, arg, result) job_trace_event(type, (u64) (arg), result)
+#else
+#define job_trace_init(arena, n_buffers)
+#define job_trace_thread_init(worker)
+#define job_trace(type, arg, result)
+b32 job_trace_dump(char* path) {
+    return false;
+}
+#endif
+#pragma endregion
+
 #pragma region jobs
 typedef struct Job Job;
+typedef struct JobGroup JobGroup;
 typedef void (*JobFunc)(Job*, void*);
 
-#define JOB_DATA_SIZE CACHE_SIZE  - (sizeof(JobFunc) + sizeof(Job*) + sizeof(volatile _Atomic(i32)))
+// NOTE(bryson): every worker keeps one deque per priority and takes jobs from the highest non-empty
+// one, locally and when stealing. See worker_lane_order for how lower lanes still make progress.
+typedef enum JobPriority {
+    JOB_PRIORITY_HIGH,
+    JOB_PRIORITY_NORMAL,
+    JOB_PRIORITY_BACKGROUND,
+    JOB_PRIORITY_COUNT,
+} JobPriority;
+
+// NOTE(bryson): an entry in a job's continuation list. Every job carries one inline so it can be the
+// continuation of a single job without allocating, graphs allocate additional entries from their arena.
+typedef struct JobContinuation {
+    Job* job;
+    struct JobContinuation* next;
+} JobContinuation;
+
+// marks a continuation list as closed once the job completed
+#define JOB_CONTINUATIONS_CLOSED ((JobContinuation*) 1)
+
+// two cache lines, so the adjacent line prefetcher doesn't drag a neighbouring job along
+#define JOB_SIZE (2 * CACHE_SIZE)
+// the fields in front of data, in order. The asserts below Job catch padding or a field missing here.
+#define JOB_DATA_SIZE (JOB_SIZE - (sizeof(JobFunc) + sizeof(Job*) + sizeof(volatile _Atomic(i32)) + sizeof(u32) + 2 * sizeof(u16)\
+                                   + sizeof(i32) + sizeof(JobContinuation*) + sizeof(JobContinuation) + sizeof(byte*)\
+                                   + sizeof(JobGroup*)))
 
 typedef struct Job {
     JobFunc function;
+    // doubles as the free list link while the job sits in a pool
     Job* parent;
     i32 unfinished_jobs;
+    // odd while the job is alive, bumped on every alloc and free
+    u32 generation;
+    // index of the pool the job returns to when freed
+    u16 owner;
+    // JobPriority, picks the lane the job is queued in
+    u16 priority;
+    // jobs that have to complete before this one is pushed, see job_add_continuation
+    i32 pending_predecessors;
+    // jobs to push once this one has completed
+    JobContinuation* continuations;
+    JobContinuation continuation_link;
+    // data that didn't fit into the job, lives in the creating worker's payload blocks
+    byte* payload;
+    // the group whose cancellation token the job obeys, inherited by children. NULL for most jobs.
+    JobGroup* group;
     char data[JOB_DATA_SIZE];
 } Job;
 
+// job pools are carved into JOB_SIZE slots and the prefetcher argument above only holds at this size
+_Static_assert(offsetof(Job, data) + JOB_DATA_SIZE == JOB_SIZE, "JOB_DATA_SIZE is out of sync with the fields of Job");
+_Static_assert(sizeof(Job) == JOB_SIZE, "Job has to fill exactly two cache lines");
+
+// NOTE(bryson): a set of jobs that can be cancelled together. Every job of the group is a child of
+// root, so waiting for root waits for the group. Cancelling only sets the token: jobs that already run
+// poll it with job_cancelled and return early, jobs that haven't started are dropped by the worker that
+// takes them, see worker_get_job.
+struct JobGroup {
+    Job* root;
+    u32 generation;
+    volatile _Atomic(i32) cancelled;
+};
+
+// cheap enough to call in an inner loop, a relaxed load unless the job belongs to no group
+b32 job_cancelled(Job* job) {
+    return job->group != NULL && atomic_load_relaxed(&job->group->cancelled);
+}
+
+// NOTE(bryson): jobs are recycled as soon as they finish. A handle remembers the generation the job
+// had when it was taken, so a finished (and possibly reused) job is never mistaken for a live one.
+typedef struct JobHandle {
+    Job* job;
+    u32 generation;
+} JobHandle;
+
+#if DEBUG
+#define job_assert_live(job) Assert((atomic_load_acquire(&(job)->generation) & 1) == 1)
+#else
+#define job_assert_live(job)
+#endif
+
 #pragma endregion
 
 #pragma region job_pool
-thread_local Job g_job_allocator[MAX_JOB_COUNT];
-thread_local u32 g_allocated_jobs = 0;
+// NOTE(bryson): every worker owns a pool that grows in JOB_SIZE-aligned slabs of JOB_SLAB_COUNT
+// jobs. Only the owner pops from free_list. Jobs freed by other threads are pushed onto remote_free
+// and the owner takes the whole list in one exchange once its local list runs dry.
+#define JOB_SLAB_COUNT 256
+
+// NOTE(bryson): payloads too big for Job.data are bump allocated from the creating worker's current
+// payload block. Every block counts the payloads still pointing into it, once a block is full it is
+// retired and the owner recycles it as soon as that count drops to zero. Payloads can be released
+// from any thread, only the owner allocates and recycles.
+#define JOB_PAYLOAD_BLOCK_SIZE Kilobytes(64)
+#define JOB_PAYLOAD_ALIGNMENT 16
+
+typedef struct JobPayloadBlock {
+    Arena arena;
+    i64 live;
+    struct JobPayloadBlock* next;
+} JobPayloadBlock;
+
+// sits in front of every payload
+typedef struct JobPayloadHeader {
+    JobPayloadBlock* block;
+    byte pad[JOB_PAYLOAD_ALIGNMENT - sizeof(JobPayloadBlock*)];
+} JobPayloadHeader;
+
+typedef struct JobPool {
+    Job* free_list;
+    u32 index;
+    u32 n_slabs;
+    JobPayloadBlock* payload_block;
+    JobPayloadBlock* retired_payload_blocks;
+    byte free_list_pad[CACHE_SIZE - sizeof(Job*) - 2 * sizeof(u32) - 2 * sizeof(JobPayloadBlock*)];
+    Job* remote_free;
+    byte remote_free_pad[CACHE_SIZE - sizeof(Job*)];
+} JobPool;
+
+// NOTE(bryson): one pool per worker plus a shared one at the end for threads that aren't workers,
+// which take shared_lock to allocate from it.
+static struct {
+    JobPool* pools;
+    u32 n_pools;
+    pthread_mutex_t shared_lock;
+} _job_pool_system;
+
+thread_local JobPool* g_thread_job_pool = NULL;
+
+void job_pool_init(JobPool* pool, u32 index) {
+    MemoryZeroStruct(pool);
+    pool->index = index;
+}
+
+void job_pool_grow(JobPool* pool) {
+    Job* slab = (Job*) aligned_alloc(JOB_SIZE, sizeof(Job) * JOB_SLAB_COUNT);
+    Assert(slab != NULL);
+    MemoryZero(slab, sizeof(Job) * JOB_SLAB_COUNT);
+
+    for (u32 i = 0; i < JOB_SLAB_COUNT; ++i) {
+        slab[i].owner = pool->index;
+        slab[i].parent = (i + 1 < JOB_SLAB_COUNT) ? &slab[i + 1] : pool->free_list;
+    }
+    pool->free_list = slab;
+    pool->n_slabs += 1;
+}
+
+JobPayloadBlock* job_payload_block_create(u64 capacity) {
+    JobPayloadBlock* block = (JobPayloadBlock*) malloc(sizeof(JobPayloadBlock));
+    block->arena = arena_create(capacity);
+    block->live = 0;
+    block->next = NULL;
+    return block;
+}
+
+// retires the current block and picks a drained block that fits size, or makes a new one
+JobPayloadBlock* job_pool_next_payload_block(JobPool* pool, u64 size) {
+    if (pool->payload_block != NULL) {
+        pool->payload_block->next = pool->retired_payload_blocks;
+        pool->retired_payload_blocks = pool->payload_block;
+    }
+
+    JobPayloadBlock** link = &pool->retired_payload_blocks;
+    for (JobPayloadBlock* block = *link; block != NULL; link = &block->next, block = block->next) {
+        if (atomic_load_acquire(&block->live) == 0 && block->arena.capacity >= size) {
+            *link = block->next;
+            block->next = NULL;
+            clear(&block->arena);
+            return block;
+        }
+    }
+
+    return job_payload_block_create(Max(size, JOB_PAYLOAD_BLOCK_SIZE));
+}
+
+byte* job_pool_payload_alloc(JobPool* pool, u64 size) {
+    u64 alloc_size = sizeof(JobPayloadHeader) + (AlignUpPow2(size, JOB_PAYLOAD_ALIGNMENT));
+    JobPayloadBlock* block = pool->payload_block;
+    // the caller copies the job's data in right away, so there is no point in zeroing it first
+    byte* memory = block ? arena_alloc_align_no_zero(&block->arena, alloc_size, JOB_PAYLOAD_ALIGNMENT) : NULL;
+    if (memory == NULL) {
+        block = job_pool_next_payload_block(pool, alloc_size);
+        pool->payload_block = block;
+        memory = arena_alloc_align_no_zero(&block->arena, alloc_size, JOB_PAYLOAD_ALIGNMENT);
+    }
+
+    atomic_increment(&block->live);
+    JobPayloadHeader* header = (JobPayloadHeader*) memory;
+    header->block = block;
+    return memory + sizeof(JobPayloadHeader);
+}
+
+byte* job_payload_alloc(u64 size) {
+    JobPool* pool = g_thread_job_pool;
+    if (pool != NULL) {
+        return job_pool_payload_alloc(pool, size);
+    }
+
+    pthread_mutex_lock(&_job_pool_system.shared_lock);
+    byte* payload = job_pool_payload_alloc(&_job_pool_system.pools[_job_pool_system.n_pools - 1], size);
+    pthread_mutex_unlock(&_job_pool_system.shared_lock);
+    return payload;
+}
+
+// another job pointing at the same payload, released by its own job_payload_free
+void job_payload_retain(byte* payload) {
+    JobPayloadHeader* header = (JobPayloadHeader*) (payload - sizeof(JobPayloadHeader));
+    atomic_increment(&header->block->live);
+}
+
+void job_payload_free(byte* payload) {
+    JobPayloadHeader* header = (JobPayloadHeader*) (payload - sizeof(JobPayloadHeader));
+    atomic_decrement(&header->block->live);
+}
+
+Job* job_pool_alloc(JobPool* pool) {
+    if (pool->free_list == NULL) {
+        pool->free_list = __atomic_exchange_n(&pool->remote_free, NULL, __ATOMIC_ACQUIRE);
+        if (pool->free_list == NULL) {
+            job_pool_grow(pool);
+        }
+    }
+
+    Job* job = pool->free_list;
+    pool->free_list = job->parent;
+    atomic_store_release(&job->generation, job->generation + 1);
+    return job;
+}
 
 Job* job_alloc() {
-    // TODO(bryson): add checks to ensure more than MAX_JOB_COUNT jobs are not allocated per frame
-    u32 idx = g_allocated_jobs++;
-    return &g_job_allocator[idx & MOD_MASK];
+    JobPool* pool = g_thread_job_pool;
+    if (pool != NULL) {
+        return job_pool_alloc(pool);
+    }
+
+    pthread_mutex_lock(&_job_pool_system.shared_lock);
+    Job* job = job_pool_alloc(&_job_pool_system.pools[_job_pool_system.n_pools - 1]);
+    pthread_mutex_unlock(&_job_pool_system.shared_lock);
+    return job;
 }
 
-Job* job_create(JobFunc function) {
-    Job* job = job_alloc();
-    MemoryZero(job, sizeof(Job));
+void job_free(Job* job) {
+    job_assert_live(job);
+    atomic_store_release(&job->generation, job->generation + 1);
+
+    JobPool* pool = &_job_pool_system.pools[job->owner];
+    if (pool == g_thread_job_pool) {
+        job->parent = pool->free_list;
+        pool->free_list = job;
+    }
+    else {
+        Job* head = atomic_load_relaxed(&pool->remote_free);
+        do {
+            job->parent = head;
+        } while (!__atomic_compare_exchange_n(&pool->remote_free, &head, job, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+}
+
+Job* job_init(Job* job, Job* parent, JobFunc function, JobPriority priority) {
+    MemoryZero(job->data, JOB_DATA_SIZE);
     job->function = function;
-    job->parent = NULL;
+    job->parent = parent;
+    job->priority = (u16) priority;
     job->unfinished_jobs = 1;
+    job->pending_predecessors = 0;
+    job->continuations = NULL;
+    job->continuation_link.job = NULL;
+    job->continuation_link.next = NULL;
+    job->payload = NULL;
+    job->group = parent ? parent->group : NULL;
     return job;
 }
 
+Job* job_create(JobFunc function) {
+    return job_init(job_alloc(), NULL, function, JOB_PRIORITY_NORMAL);
+}
+
+Job* job_create_with_priority(JobFunc function, JobPriority priority) {
+    return job_init(job_alloc(), NULL, function, priority);
+}
+
+// children run at their parent's priority
 Job* job_create_child(Job* parent, JobFunc function) {
+    job_assert_live(parent);
     atomic_increment(&parent->unfinished_jobs);
 
-    Job* job = job_alloc();
-    MemoryZero(job, sizeof(Job));
-    job->function = function;
-    job->parent = parent;
-    job->unfinished_jobs = 1;
-    return job;
+    return job_init(job_alloc(), parent, function, (JobPriority) parent->priority);
+}
+
+// Returns size bytes of data for the job to be filled in place, from Job.data if it fits and from a
+// payload owned by the calling worker otherwise. The payload is released when the job finishes.
+byte* job_reserve_data(Job* job, u32 size) {
+    job_assert_live(job);
+    if (job->payload != NULL) {
+        job_payload_free(job->payload);
+        job->payload = NULL;
+    }
+
+    if (size <= JOB_DATA_SIZE) {
+        return (byte*) job->data;
+    }
+    job->payload = job_payload_alloc(size);
+    return job->payload;
 }
 
+// Copies size bytes into the job, see job_reserve_data. Either way the job function gets a pointer to
+// the copy.
 void job_write_data(Job* job, char* data, u32 size) {
-    Assert(size < JOB_DATA_SIZE);
-    MemoryCopy(job->data, data, size);
+    MemoryCopy(job_reserve_data(job, size), data, size);
+}
+
+void* job_get_data(Job* job) {
+    return job->payload ? (void*) job->payload : (void*) job->data;
 }
 
 b32 job_empty(Job* job) {
     return job == NULL;
 }
 
+typedef struct Worker Worker;
+Worker* job_system_thread_worker();
+void worker_submit(Worker* worker, Job* job);
+void job_system_submit(Job* job);
+Arena* job_scratch();
+u64 job_stats_begin();
+void job_stats_end(JobFunc function, u64 start);
+
+void job_push_continuation(Job* job, JobContinuation* continuation) {
+    atomic_increment(&continuation->job->pending_predecessors);
+
+    JobContinuation* head = atomic_load_relaxed(&job->continuations);
+    do {
+        // attaching to a job that already completed would never run the continuation
+        Assert(head != JOB_CONTINUATIONS_CLOSED);
+        continuation->next = head;
+    } while (!__atomic_compare_exchange_n(&job->continuations, &head, continuation, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Runs continuation after job (and all of its children) completed. The continuation is pushed onto
+// the deque of the worker that finishes job, so it must not be submitted by hand. job must not have
+// completed yet: attach before submitting it, or from inside job or one of its children. Each job can
+// be the continuation of a single job this way, use a JobGraph for several predecessors.
+void job_add_continuation(Job* job, Job* continuation) {
+    job_assert_live(job);
+    job_assert_live(continuation);
+    Assert(continuation->continuation_link.job == NULL);
+
+    continuation->continuation_link.job = continuation;
+    job_push_continuation(job, &continuation->continuation_link);
+}
+
 void job_finish(Job* job) {
-    atomic_decrement(&job->unfinished_jobs);
-    if ((job->unfinished_jobs == 0) && (job->parent)) {
-        job_finish(job->parent);
+    Job* parent = job->parent;
+    // only the thread that takes the count to zero may touch the job afterwards
+    if (atomic_decrement(&job->unfinished_jobs) == 1) {
+        JobContinuation* continuation = __atomic_exchange_n(&job->continuations, JOB_CONTINUATIONS_CLOSED, __ATOMIC_ACQ_REL);
+        while (continuation != NULL) {
+            // read next first, the continuation may run and be freed as soon as it is pushed
+            JobContinuation* next = continuation->next;
+            Job* successor = continuation->job;
+            if (atomic_decrement(&successor->pending_predecessors) == 1) {
+                // the link of a job_add_continuation is spent now, and off a worker job_system_submit
+                // queues the successor through that very link
+                if (continuation == &successor->continuation_link) {
+                    continuation->job = NULL;
+                }
+                job_system_submit(successor);
+            }
+            continuation = next;
+        }
+
+        if (parent) {
+            job_finish(parent);
+        }
+        if (job->payload != NULL) {
+            job_payload_free(job->payload);
+        }
+        job_free(job);
     }
 }
 
+// Everything a job allocates from job_scratch() is released once its function returns.
 void job_execute(Job* job) {
-    (job->function)(job, job->data);
+    job_assert_live(job);
+    TempArena scratch = temp_arena_begin(job_scratch());
+    JobFunc function = job->function;
+    u64 start = job_stats_begin();
+    job_trace(JOB_TRACE_JOB_BEGIN, function, 0);
+    function(job, job_get_data(job));
+    job_trace(JOB_TRACE_JOB_END, function, 0);
+    job_stats_end(function, start);
+    temp_arena_end(&scratch);
     job_finish(job);
 }
 
+JobHandle job_handle(Job* job) {
+    job_assert_live(job);
+    JobHandle handle = {
+        .job = job,
+        .generation = atomic_load_acquire(&job->generation),
+    };
+    return handle;
+}
+
+Job* job_handle_get(JobHandle handle) {
+    // stale handle, the job already finished and went back to its pool
+    Assert(atomic_load_acquire(&handle.job->generation) == handle.generation);
+    return handle.job;
+}
+
+b32 job_handle_completed(JobHandle handle) {
+    return atomic_load_acquire(&handle.job->generation) != handle.generation
+        || atomic_load_acquire(&handle.job->unfinished_jobs) == 0;
+}
+
 b32 job_has_completed(Job* job) {
-    return job->unfinished_jobs == 0;
+    return atomic_load_acquire(&job->unfinished_jobs) == 0;
 }
 #pragma endregion
 
 #pragma region job_queue
+// NOTE(bryson): Chase-Lev work-stealing deque (Le et al., "Correct and Efficient Work-Stealing for
+// Weak Memory Models"). The owning worker pushes and pops at the bottom, thieves take from the top.
+// Only the owner may call job_queue_push / job_queue_pop, any thread may call job_queue_steal.
+// bottom and top are padded onto their own cache lines since they are written by different threads.
 typedef struct JobQueue {
+    i64 bottom;
+    byte bottom_pad[CACHE_SIZE - sizeof(i64)];
+    i64 top;
+    byte top_pad[CACHE_SIZE - sizeof(i64)];
     Job* jobs[MAX_JOB_COUNT];
-    u32 bottom;
-    u32 top;
-    pthread_mutex_t lock;
 } JobQueue;
 
 JobQueue job_queue_create() {
-    JobQueue  queue;
+    JobQueue queue;
     queue.bottom = 0;
     queue.top = 0;
 
     MemoryZero(queue.jobs, sizeof(Job*) * MAX_JOB_COUNT);
 
-    i32 error = pthread_mutex_init(&queue.lock, NULL);
-    if (error != 0) {
-        printf("cannot create mutex: %s", strerror(error));
-    }
-
     return queue;
 }
 
+i64 job_queue_size(JobQueue* queue) {
+    i64 bottom = atomic_load_relaxed(&queue->bottom);
+    i64 top = atomic_load_relaxed(&queue->top);
+    return ClampBot(bottom - top, 0);
+}
+
 b32 job_queue_push(JobQueue* queue, Job* job) {
-    pthread_mutex_lock(&queue->lock);
-    b32 pushed = true;
-    if (queue->bottom - queue->top < MAX_JOB_COUNT) {
-        queue->jobs[queue->bottom & MOD_MASK] = job;
-        ++queue->bottom;
+    i64 bottom = atomic_load_relaxed(&queue->bottom);
+    i64 top = atomic_load_acquire(&queue->top);
+
+    if (bottom - top >= MAX_JOB_COUNT) {
+        return false;
     }
-    else {
-        pushed = false;
+
+    atomic_store_relaxed(&queue->jobs[bottom & MOD_MASK], job);
+    // make the job visible before thieves can observe the new bottom
+    atomic_fence_release();
+    atomic_store_relaxed(&queue->bottom, bottom + 1);
+
+    return true;
+}
+
+// Pushes as many of the jobs as fit with a single reservation and publish, returns how many.
+u32 job_queue_push_batch(JobQueue* queue, Job** jobs, u32 count) {
+    i64 bottom = atomic_load_relaxed(&queue->bottom);
+    i64 top = atomic_load_acquire(&queue->top);
+
+    u32 n_pushed = (u32) Min((i64) count, MAX_JOB_COUNT - (bottom - top));
+    if (n_pushed == 0) {
+        return 0;
+    }
+
+    for (u32 i = 0; i < n_pushed; ++i) {
+        atomic_store_relaxed(&queue->jobs[(bottom + i) & MOD_MASK], jobs[i]);
     }
-    pthread_mutex_unlock(&queue->lock);
+    atomic_fence_release();
+    atomic_store_relaxed(&queue->bottom, bottom + n_pushed);
 
-    return pushed;
+    return n_pushed;
 }
 
 Job* job_queue_pop(JobQueue* queue) {
-    pthread_mutex_lock(&queue->lock);
-    Job* job = NULL;
+    i64 bottom = atomic_load_relaxed(&queue->bottom) - 1;
+    atomic_store_relaxed(&queue->bottom, bottom);
+    // the bottom reservation must be ordered before reading top, otherwise a thief and the owner
+    // could both take the last job
+    atomic_fence_seq_cst();
+    i64 top = atomic_load_relaxed(&queue->top);
 
-    i32 job_count = queue->bottom - queue->top;
-    if (job_count > 0)  {
-        --queue->bottom;
-        job = queue->jobs[queue->bottom & MOD_MASK];
+    Job* job = NULL;
+    if (top <= bottom) {
+        job = atomic_load_relaxed(&queue->jobs[bottom & MOD_MASK]);
+        if (top == bottom) {
+            // last job in the queue, race the thieves for it
+            if (!__atomic_compare_exchange_n(&queue->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                job = NULL;
+            }
+            atomic_store_relaxed(&queue->bottom, bottom + 1);
+        }
+    }
+    else {
+        // queue was already empty, undo the reservation
+        atomic_store_relaxed(&queue->bottom, bottom + 1);
     }
 
-    pthread_mutex_unlock(&queue->lock);
     return job;
 }
 
 Job* job_queue_steal(JobQueue* queue) {
-    pthread_mutex_lock(&queue->lock);
+    i64 top = atomic_load_acquire(&queue->top);
+    atomic_fence_seq_cst();
+    i64 bottom = atomic_load_acquire(&queue->bottom);
+
     Job* job = NULL;
-    i32 job_count = queue->bottom - queue->top;
-    if (job_count > 0) {
-        job = queue->jobs[queue->top & MOD_MASK];
-        ++queue->top;
+    if (top < bottom) {
+        job = atomic_load_relaxed(&queue->jobs[top & MOD_MASK]);
+        // lost the race against another thief or the owner popping the last job
+        if (!__atomic_compare_exchange_n(&queue->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return NULL;
+        }
     }
-    pthread_mutex_unlock(&queue->lock);
     return job;
 }
 #pragma endregion
 
-#pragma region workers
-typedef struct Worker {
-    pthread_t thread_id;
-    JobQueue queue;
-} Worker;
-
-static struct {
-    Worker* workers;
-    u32 n_workers;
-    Arena arena;
-
-    pthread_mutex_t suspend_mutex;
-    pthread_cond_t  resume_cond;
-} _job_system;
-
-void* worker_proc(void* arg);
-void job_system_init() {
-    _job_system.arena = arena_create(Megabytes(4));
-    _job_system.n_workers = get_available_cores();
-    _job_system.workers = arena_push_array(&_job_system.arena, Worker, _job_system.n_workers);
+#pragma region injection_queue
+// NOTE(bryson): Vyukov's intrusive MPSC queue for jobs submitted by threads that aren't workers.
+// Producers only exchange head, so pushing never blocks. Workers take turns as the single consumer
+// through the consuming flag and move what they take into their own deque. Jobs are linked through
+// their continuation_link rather than a field of their own, Job has no room to spare. The link is free
+// once a job can be submitted: job_add_continuation is the only other user, and job_finish clears it
+// before releasing the successor. job_injection_queue_drain clears it again on the way out.
+typedef struct JobInjectionQueue {
+    JobContinuation* head;
+    byte head_pad[CACHE_SIZE - sizeof(JobContinuation*)];
+    // only touched by whoever holds consuming
+    JobContinuation* tail;
+    i32 consuming;
+    byte tail_pad[CACHE_SIZE - sizeof(JobContinuation*) - sizeof(i32)];
+    JobContinuation stub;
+} JobInjectionQueue;
+
+void job_injection_queue_init(JobInjectionQueue* queue) {
+    queue->stub.job = NULL;
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+    queue->consuming = false;
+}
 
-    pthread_mutex_init(&_job_system.suspend_mutex, NULL);
-    pthread_cond_init(&_job_system.resume_cond, NULL);
+void job_injection_queue_push_node(JobInjectionQueue* queue, JobContinuation* node) {
+    atomic_store_relaxed(&node->next, NULL);
+    JobContinuation* prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+    // the queue is briefly cut here, the consumer sees prev without a next until the link lands
+    atomic_store_release(&prev->next, node);
+}
 
-    for (int i = 0; i < _job_system.n_workers; ++i) {
-        Worker* worker = &_job_system.workers[i];
-        worker->queue = job_queue_create();
-        pthread_create(&worker->thread_id, NULL, worker_proc, (void*)worker);
-        pthread_detach(worker->thread_id);
-    }
+void job_injection_queue_push(JobInjectionQueue* queue, Job* job) {
+    job_assert_live(job);
+    // a job waiting on predecessors is submitted by the last of them, which frees the link first
+    Assert(job->continuation_link.job == NULL);
+    job->continuation_link.job = job;
+    job_injection_queue_push_node(queue, &job->continuation_link);
 }
 
-Worker* job_system_get_random_worker() {
-    u32 rand_idx = irand_range(0, _job_system.n_workers);
-    return &_job_system.workers[rand_idx];
+b32 job_injection_queue_empty(JobInjectionQueue* queue) {
+    return atomic_load_acquire(&queue->head) == &queue->stub;
 }
 
-Worker* job_system_find_worker(pthread_t thread_id) {
-    for (i32 i = 0; i < _job_system.n_workers; ++i) {
-        if (pthread_equal(_job_system.workers[i].thread_id, thread_id)) {
-            return &_job_system.workers[i];
+// single consumer, returns NULL when empty or when the next job is still being linked in
+JobContinuation* job_injection_queue_pop_node(JobInjectionQueue* queue) {
+    JobContinuation* tail = queue->tail;
+    JobContinuation* next = atomic_load_acquire(&tail->next);
+    if (tail == &queue->stub) {
+        if (next == NULL) {
+            return NULL;
         }
+        queue->tail = next;
+        tail = next;
+        next = atomic_load_acquire(&next->next);
     }
-    return NULL;
-}
 
-Worker* job_system_thread_worker() {
-    for (i32 i = 0; i < _job_system.n_workers; ++i) {
-        if (_job_system.workers[i].queue.bottom - _job_system.workers[i].queue.top < MAX_JOB_COUNT) {
-            return &_job_system.workers[i];
-        }
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_acquire(&queue->head)) {
+        return NULL;
+    }
+
+    // tail is the last node, put the stub behind it so it can be taken
+    job_injection_queue_push_node(queue, &queue->stub);
+    next = atomic_load_acquire(&tail->next);
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
     }
     return NULL;
 }
 
-Job* worker_get_job(Worker* worker) {
-    Job* job = job_queue_pop(&worker->queue);
-
-    if (job_empty(job)) {
-        // select random queue to steal from bc we got invalid job
-        Worker* steal_worker = job_system_get_random_worker();
+// Takes up to max_jobs of the oldest jobs, returns how many. Returns 0 if the queue is empty or another
+// worker is draining it right now.
+u32 job_injection_queue_drain(JobInjectionQueue* queue, Job** jobs, u32 max_jobs) {
+    if (job_injection_queue_empty(queue) || __atomic_exchange_n(&queue->consuming, true, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
 
-        // we don't want to steal from ourself, try again next time
-        if (steal_worker == worker) {
-            yield();
-            return NULL;
-        }
-        
-        Job* stolen_job = job_queue_steal(&steal_worker->queue);
-        // stolen job was empty, try again next time
-        if (job_empty(stolen_job)) {
-            yield();
-            return NULL;
-        }
-        return stolen_job;
+    u32 n_jobs = 0;
+    JobContinuation* node = NULL;
+    while (n_jobs < max_jobs && (node = job_injection_queue_pop_node(queue)) != NULL) {
+        jobs[n_jobs++] = node->job;
+        node->job = NULL;
     }
 
-    return job;
+    atomic_store_release(&queue->consuming, false);
+    return n_jobs;
 }
+#pragma endregion
 
-void worker_wait(Worker* worker, Job* job) {
-    while(!job_has_completed(job)) {
-        Job* next_job = worker_get_job(worker);
-        if (!job_empty(next_job)) {
-            job_execute(next_job);
+#pragma region timer_wheel
+// NOTE(bryson): hierarchical timing wheel. Level l has TIMER_WHEEL_SLOTS slots covering 64^l ticks
+// each. A timer goes into the lowest level its delay fits in and drops a level every time the wheel
+// reaches its slot, so adding and cancelling are O(1) and a timer is moved at most once per level.
+// The bitmaps of occupied slots let the wheel jump straight to the next tick that has work.
+#define TIMER_WHEEL_BITS 6
+// one bit per slot in a u64
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 6
+// timers further out than this wait in the last level and are put back in when their slot comes up
+#define TIMER_WHEEL_MAX_DELAY ((1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+#define TIMER_SLAB_COUNT 1024
+#define TIMER_TICK_NONE ULLONG_MAX
+
+typedef struct JobTimerEntry {
+    struct JobTimerEntry* next;
+    // the next field of the previous entry, or the slot itself
+    struct JobTimerEntry** prev_next;
+    // tick the timer fires at
+    u64 expiry;
+    // in ticks, 0 for one-shot timers
+    u64 period;
+    Job* job;
+    // odd while the timer is pending, bumped on every alloc and free like Job.generation
+    u32 generation;
+    u8 level;
+    u8 slot;
+} JobTimerEntry;
+
+// NOTE(bryson): a timer is cancelled through the generation it had when it was added, so a timer that
+// already fired (and whose entry may have been reused) is never cancelled by mistake.
+typedef struct JobTimer {
+    JobTimerEntry* entry;
+    u32 generation;
+} JobTimer;
+
+typedef struct TimerWheel {
+    JobTimerEntry* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    u64 occupied[TIMER_WHEEL_LEVELS];
+    // last tick that was processed
+    u64 current;
+    JobTimerEntry* free_list;
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel* wheel, u64 current) {
+    MemoryZeroStruct(wheel);
+    wheel->current = current;
+}
+
+JobTimerEntry* timer_wheel_alloc(TimerWheel* wheel) {
+    if (wheel->free_list == NULL) {
+        JobTimerEntry* slab = (JobTimerEntry*) malloc(sizeof(JobTimerEntry) * TIMER_SLAB_COUNT);
+        Assert(slab != NULL);
+        MemoryZero(slab, sizeof(JobTimerEntry) * TIMER_SLAB_COUNT);
+        for (u32 i = 0; i < TIMER_SLAB_COUNT; ++i) {
+            slab[i].next = (i + 1 < TIMER_SLAB_COUNT) ? &slab[i + 1] : NULL;
         }
+        wheel->free_list = slab;
     }
-}
 
-void worker_poll() {
-    pthread_cond_signal(&_job_system.resume_cond);
-    yield();
+    JobTimerEntry* entry = wheel->free_list;
+    wheel->free_list = entry->next;
+    entry->generation += 1;
+    return entry;
 }
 
-void worker_submit(Worker* worker, Job* job) {
-    while(!job_queue_push(&worker->queue, job)) {
-        worker_poll();
-    };
-    pthread_cond_signal(&_job_system.resume_cond);
+void timer_wheel_free(TimerWheel* wheel, JobTimerEntry* entry) {
+    entry->generation += 1;
+    entry->next = wheel->free_list;
+    wheel->free_list = entry;
 }
 
-void* worker_proc(void* arg) {
-    for(;;) {
-        Job* job = worker_get_job((Worker*) arg);
-        if (!job_empty(job)) {
-            job_execute(job);
-        }
-        else {
-            pthread_mutex_lock(&_job_system.suspend_mutex);
-            pthread_cond_wait(&_job_system.resume_cond, &_job_system.suspend_mutex);
-            pthread_mutex_unlock(&_job_system.suspend_mutex);
+b32 timer_wheel_empty(TimerWheel* wheel) {
+    for (u32 level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        if (wheel->occupied[level] != 0) {
+            return false;
         }
     }
+    return true;
 }
-#pragma endregion
-
-#pragma region dispatch
-
-typedef void (*ParFunc)(void*, u32);
-
-#define PAR_GROUP_SIZE 32
-typedef struct ParallelForData {
-    void* data;
-    u32 job_count;
-    ParFunc par_func;
-} ParallelForData;
 
-void parallel_for_job(Job* job, void* data) {
-    const ParallelForData* job_data = (ParallelForData*) data;
+void timer_wheel_insert(TimerWheel* wheel, JobTimerEntry* entry) {
+    Assert(entry->expiry >= wheel->current);
+    u64 delay = ClampTop(entry->expiry - wheel->current, TIMER_WHEEL_MAX_DELAY);
+    u32 level = 0;
+    while (delay >> (TIMER_WHEEL_BITS * (level + 1)) != 0) {
+        level += 1;
+    }
 
-    if (job_data->job_count > PAR_GROUP_SIZE) {
-        Worker* worker = job_system_thread_worker();
+    u32 slot = (u32) ((wheel->current + delay) >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    JobTimerEntry** head = &wheel->slots[level][slot];
+    entry->next = *head;
+    if (*head != NULL) {
+        (*head)->prev_next = &entry->next;
+    }
+    entry->prev_next = head;
+    entry->level = (u8) level;
+    entry->slot = (u8) slot;
+    *head = entry;
+    wheel->occupied[level] |= 1ull << slot;
+}
 
-        const u32 left_count = job_data->job_count / 2u;
-        const ParallelForData left_data = {
-            .data = job_data->data,
-            .job_count = left_count,
-            .par_func = job_data->par_func,
-        };
+void timer_wheel_remove(TimerWheel* wheel, JobTimerEntry* entry) {
+    *entry->prev_next = entry->next;
+    if (entry->next != NULL) {
+        entry->next->prev_next = entry->prev_next;
+    }
+    if (wheel->slots[entry->level][entry->slot] == NULL) {
+        wheel->occupied[entry->level] &= ~(1ull << entry->slot);
+    }
+}
 
-        Job* left = job_create_child(job, &parallel_for_job);
-        job_write_data(left, (char*)&left_data, sizeof(ParallelForData));
-        worker_submit(worker, left);
+JobTimerEntry* timer_wheel_take_slot(TimerWheel* wheel, u32 level, u32 slot) {
+    JobTimerEntry* entries = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ull << slot);
+    return entries;
+}
 
-        const u32 right_count = job_data->job_count - left_count;
-        const ParallelForData right_data = {
-                .data = job_data->data + left_count,
-                .job_count = right_count,
-                .par_func = job_data->par_func,
-        };
+// First tick after current that reaches an occupied slot, TIMER_TICK_NONE if the wheel is empty. The
+// slots of level l are reached every 64^l ticks, in order, starting after the one current is in.
+u64 timer_wheel_next_tick(TimerWheel* wheel) {
+    u64 next = TIMER_TICK_NONE;
+    for (u32 level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        u64 occupied = wheel->occupied[level];
+        if (occupied == 0) {
+            continue;
+        }
 
-        Job* right = job_create_child(job, &parallel_for_job);
-        job_write_data(right, (char*)&right_data, sizeof(ParallelForData));
-        worker_submit(worker, right);
-    }
-    else {
-        (job_data->par_func)(job_data->data, job_data->job_count);
+        u32 shift = TIMER_WHEEL_BITS * level;
+        u64 block = wheel->current >> shift;
+        u32 start = (u32) (block + 1) & TIMER_WHEEL_MASK;
+        u64 rotated = (occupied >> start) | (occupied << ((TIMER_WHEEL_SLOTS - start) & TIMER_WHEEL_MASK));
+        u64 distance = (u64) __builtin_ctzll(rotated) + 1;
+        next = Min(next, (block + distance) << shift);
     }
+    return next;
 }
 
-Job* parallel_for(void* data, u32 count, ParFunc par_func) {
-    ParallelForData job_data = {
-        .data = data,
-        .job_count = count,
-        .par_func = par_func,
-    };
+// Processes every tick up to and including target and returns the timers that expired, linked through
+// next. The entries are out of the wheel but still allocated.
+JobTimerEntry* timer_wheel_advance(TimerWheel* wheel, u64 target) {
+    JobTimerEntry* expired = NULL;
+    for (u64 tick = timer_wheel_next_tick(wheel); tick <= target; tick = timer_wheel_next_tick(wheel)) {
+        wheel->current = tick;
+
+        // cascade from the highest level this tick starts a slot of, a timer may drop several levels
+        u32 top = 0;
+        while (top + 1 < TIMER_WHEEL_LEVELS && (tick & ((1ull << (TIMER_WHEEL_BITS * (top + 1))) - 1)) == 0) {
+            top += 1;
+        }
+        for (u32 level = top; level > 0; --level) {
+            u32 slot = (u32) (tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+            JobTimerEntry* entry = timer_wheel_take_slot(wheel, level, slot);
+            while (entry != NULL) {
+                JobTimerEntry* next = entry->next;
+                timer_wheel_insert(wheel, entry);
+                entry = next;
+            }
+        }
 
-    Job* job = job_create(&parallel_for_job);
-    job_write_data(job, (char*)&job_data, sizeof(ParallelForData));
-    return job;
+        JobTimerEntry* entry = timer_wheel_take_slot(wheel, 0, (u32) tick & TIMER_WHEEL_MASK);
+        while (entry != NULL) {
+            JobTimerEntry* next = entry->next;
+            entry->next = expired;
+            expired = entry;
+            entry = next;
+        }
+    }
+    wheel->current = Max(wheel->current, target);
+    return expired;
 }
-
 #pragma endregion
 
+#pragma region workers
+// NOTE(bryson): number of failed job fetches a worker backs off through before it parks
+#define WORKER_SPIN_COUNT 64
+#define WORKER_MAX_BACKOFF 64
+
+typedef enum WorkerState {
+    WORKER_STATE_RUNNING,
+    WORKER_STATE_PARKED,
+} WorkerState;
+
+typedef enum StealPolicy {
+    // uniformly random victim, one attempt per fetch
+    STEAL_POLICY_RANDOM,
+    // smt siblings first, then cores sharing the last level cache, then the package, then remote
+    STEAL_POLICY_LOCALITY,
+} StealPolicy;
+
+typedef struct JobSystemOptions {
+    // 0 creates one worker per cpu the process may run on
+    u32 n_workers;
+    // pins every worker the job system starts to its own logical cpu
+    b32 pin_workers;
+    // also pins the calling thread (worker 0). Threads it creates afterwards inherit that single cpu,
+    // only the job system's own helper threads are started with the affinity it had before.
+    b32 pin_main_thread;
+    // slots for threads that join later through job_system_register_thread
+    u32 n_external_workers;
+    // most workers started to stand in for jobs blocked between job_blocking_begin and _end. Off by
+    // default, with 0 a blocked worker's core just stays idle
+    u32 n_spare_workers;
+    // a spare worker that wasn't needed for this long exits
+    u64 spare_retire_ns;
+    StealPolicy steal_policy;
+    // run jobs on fibers so worker_wait suspends the waiting job instead of nesting on the stack
+    b32 use_fibers;
+    u32 fibers_per_worker;
+    u64 fiber_stack_size;
+    // size of the scratch arena behind job_scratch(), one per worker and one per fiber
+    u64 scratch_size;
+    // record a latency histogram per JobFunc, see job_system_latency_histograms
+    b32 job_histograms;
+    // start the timer thread behind job_submit_after and job_submit_every
+    b32 use_timers;
+    // length of a timer tick, delays are rounded up to whole ticks
+    u64 timer_resolution_ns;
+} JobSystemOptions;
+
+// returns true once a wait on something other than a job is over, see job_system_wait_until
+typedef b32 (*JobReadyFunc)(void* arg);
+
+// a suspended fiber and what it is waiting for
+typedef struct FiberWait {
+    Fiber* fiber;
+    // the job it waits on, unless ready is set
+    JobHandle handle;
+    JobReadyFunc ready;
+    void* ready_arg;
+} FiberWait;
+
+b32 fiber_wait_over(FiberWait* wait) {
+    return wait->ready ? wait->ready(wait->ready_arg) : job_handle_completed(wait->handle);
+}
+
+// NOTE(bryson): latencies go into power of two buckets, bucket i counts executions that took
+// [2^(i-1), 2^i) ns and the last bucket everything above. Functions past JOB_LATENCY_MAX_FUNCTIONS
+// share the overflow entry at the end of the table, which has no function.
+#define JOB_LATENCY_BUCKET_COUNT 40
+#define JOB_LATENCY_MAX_FUNCTIONS 64
+
+typedef struct JobLatencyHistogram {
+    JobFunc function;
+    u64 count;
+    u64 total_ns;
+    u64 max_ns;
+    u64 buckets[JOB_LATENCY_BUCKET_COUNT];
+} JobLatencyHistogram;
+
+typedef enum WorkerActivity {
+    WORKER_ACTIVITY_IDLE,
+    WORKER_ACTIVITY_BUSY,
+    // the thread is running its own code outside of the job system (worker 0 between waits)
+    WORKER_ACTIVITY_OUTSIDE,
+} WorkerActivity;
+
+// NOTE(bryson): only ever written by the owning worker, so the counters are plain relaxed stores.
+// Readers on other threads may see a snapshot that is a few events stale.
+typedef struct WorkerStats {
+    u64 jobs_executed;
+    // jobs of cancelled groups that were dropped instead of run
+    u64 jobs_cancelled;
+    u64 local_pops;
+    u64 steal_attempts;
+    u64 steal_successes;
+    u64 max_queue_depth;
+    u64 idle_ticks;
+    u64 busy_ticks;
+    // start of the current stretch of activity
+    u64 mark;
+    u32 activity;
+    // JOB_LATENCY_MAX_FUNCTIONS entries plus the overflow entry, NULL unless job_histograms is set
+    JobLatencyHistogram* histograms;
+} WorkerStats;
+
+#define job_stat_add(field, n) atomic_store_relaxed(&(field), (field) + (n))
+
+typedef struct JobSystemStats {
+    u64 jobs_executed;
+    u64 jobs_cancelled;
+    u64 local_pops;
+    u64 steal_attempts;
+    u64 steal_successes;
+    // deepest any of the queues got
+    u64 max_queue_depth;
+    u64 idle_ns;
+    u64 busy_ns;
+    // steal_successes / steal_attempts
+    f64 steal_success_rate;
+    // idle_ns / (idle_ns + busy_ns)
+    f64 idle_ratio;
+} JobSystemStats;
+
+struct Worker {
+    pthread_t thread_id;
+    u32 index;
+    // one deque per JobPriority
+    JobQueue queues[JOB_PRIORITY_COUNT];
+    // number of job fetches, drives the lane rotation in worker_lane_order
+    u32 n_fetches;
+
+    CpuInfo cpu;
+    u32 rng;
+    // the job system's other workers ordered by distance, victim_tier_ends[d] is one past the last one at
+    // distance d. External and spare slots aren't in here, see worker_steal_guests.
+    u32* victims;
+    u32 victim_tier_ends[CPU_DISTANCE_COUNT];
+
+    // NOTE(bryson): fibers never migrate between workers, a suspended fiber is resumed by the
+    // worker that suspended it once the job it waits on has completed
+    FiberPool fiber_pool;
+    Fiber thread_fiber;
+    Fiber* current_fiber;
+    FiberWait* waiting;
+    u32 n_waiting;
+
+    // scratch arena of whatever is running on the worker right now, the thread's own stack uses
+    // scratch_arena and every pool fiber its entry in fiber_scratch
+    Arena* scratch;
+    Arena scratch_arena;
+    Arena* fiber_scratch;
+
+    // set while a thread occupies an external or spare slot, see job_system_register_thread and
+    // job_blocking_begin
+    i32 registered;
+
+    // padded away from the queue, which thieves keep reading, and from state
+    byte stats_pad[CACHE_SIZE];
+    WorkerStats stats;
+    byte stats_end_pad[CACHE_SIZE];
+
+    // written by other workers when they wake this one, so kept off the queue's cache lines
+    i32 state;
+#if !defined(__gnu_linux__)
+    pthread_mutex_t park_mutex;
+    pthread_cond_t park_cond;
+#endif
+};
+
+// NOTE(bryson): workers [0, first_external) run on threads of the job system (worker 0 being the
+// thread that called job_system_init), [first_external, first_spare) are slots for registered external
+// threads and the rest are slots for spare workers.
+static struct {
+    Worker* workers;
+    u32 n_workers;
+    u32 first_external;
+    u32 first_spare;
+    Arena arena;
+
+    // workers inside job_blocking_begin/_end and the spares running in their place. Both only change
+    // through atomics, spare_lock guards starting spares and handing activations to idle ones.
+    i32 n_blocking;
+    i32 n_active_spares;
+    i32 n_idle_spares;
+    // activations handed out that no idle spare has picked up yet
+    i32 n_spare_wakeups;
+    u64 spare_retire_ns;
+    pthread_mutex_t spare_lock;
+    pthread_cond_t spare_cond;
+
+    // jobs submitted by threads that aren't workers
+    JobInjectionQueue injection;
+
+    CpuTopology topology;
+    // the affinity of the thread that called job_system_init before any pinning, for the timer, io
+    // and spare threads
+    pthread_attr_t thread_attr;
+    StealPolicy steal_policy;
+    b32 use_fibers;
+
+    i32 n_sleeping;
+} _job_system;
+
+// NOTE(bryson): the queues are single-owner, so every thread has to push into its own worker.
+// The thread calling job_system_init becomes worker 0 and helps out while it waits on jobs. Other
+// threads either register as a worker or submit through the injection queue.
+thread_local Worker* g_thread_worker = NULL;
+
+JobSystemOptions job_system_default_options() {
+    JobSystemOptions options = {
+        .n_workers = 0,
+        .pin_workers = true,
+        .pin_main_thread = false,
+        .n_external_workers = 0,
+        .n_spare_workers = 0,
+        .spare_retire_ns = 1000000000ull,
+        .steal_policy = STEAL_POLICY_LOCALITY,
+        .use_fibers = false,
+        .fibers_per_worker = 64,
+        .fiber_stack_size = FIBER_DEFAULT_STACK_SIZE,
+        .scratch_size = Kilobytes(256),
+        .job_histograms = false,
+        .use_timers = true,
+        .timer_resolution_ns = 1000000,
+    };
+    return options;
+}
+
+u32 worker_rand(Worker* worker) {
+    // xorshift32
+    u32 x = worker->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    worker->rng = x;
+    return x;
+}
+
+void worker_build_victims(Worker* worker) {
+    u32 n_workers = _job_system.first_external;
+    worker->victims = arena_push_array(&_job_system.arena, u32, n_workers);
+
+    u32 n_victims = 0;
+    for (u32 distance = 0; distance < CPU_DISTANCE_COUNT; ++distance) {
+        for (u32 i = 1; i <= n_workers; ++i) {
+            Worker* other = &_job_system.workers[(worker->index + i) % n_workers];
+            if (other != worker && cpu_distance(&worker->cpu, &other->cpu) == distance) {
+                worker->victims[n_victims++] = other->index;
+            }
+        }
+        worker->victim_tier_ends[distance] = n_victims;
+    }
+}
+
+u32 worker_victim_count(Worker* worker) {
+    return worker->victim_tier_ends[CPU_DISTANCE_COUNT - 1];
+}
+
+void* worker_proc(void* arg);
+void job_timers_start(u64 resolution_ns);
+void job_system_init_with_options(JobSystemOptions options) {
+    // sized by the worker count, fiber count and histograms, so let it grow with them
+    _job_system.arena = arena_reserve(arena_default_options());
+    _job_system.topology = cpu_topology_read(&_job_system.arena);
+    _job_system.first_external = options.n_workers ? options.n_workers : _job_system.topology.n_cpus;
+    _job_system.first_spare = _job_system.first_external + options.n_external_workers;
+    _job_system.n_workers = _job_system.first_spare + options.n_spare_workers;
+    _job_system.steal_policy = options.steal_policy;
+    _job_system.use_fibers = options.use_fibers && FIBER_SUPPORTED;
+    _job_system.workers = arena_push_array(&_job_system.arena, Worker, _job_system.n_workers);
+
+    _job_pool_system.n_pools = _job_system.n_workers + 1;
+    // Job.owner is 16 bits
+    Assert(_job_pool_system.n_pools <= USHRT_MAX);
+    _job_pool_system.pools = arena_push_array(&_job_system.arena, JobPool, _job_pool_system.n_pools);
+    for (u32 i = 0; i < _job_pool_system.n_pools; ++i) {
+        job_pool_init(&_job_pool_system.pools[i], i);
+    }
+    pthread_mutex_init(&_job_pool_system.shared_lock, NULL);
+
+    job_injection_queue_init(&_job_system.injection);
+    _job_system.n_sleeping = 0;
+    _job_system.n_blocking = 0;
+    _job_system.n_active_spares = 0;
+    _job_system.n_idle_spares = 0;
+    _job_system.n_spare_wakeups = 0;
+    _job_system.spare_retire_ns = options.spare_retire_ns;
+    pthread_mutex_init(&_job_system.spare_lock, NULL);
+    pthread_cond_init(&_job_system.spare_cond, NULL);
+    job_clock_init();
+    job_trace_init(&_job_system.arena, _job_system.n_workers);
+
+    for (int i = 0; i < _job_system.n_workers; ++i) {
+        Worker* worker = &_job_system.workers[i];
+        worker->index = i;
+        for (u32 lane = 0; lane < JOB_PRIORITY_COUNT; ++lane) {
+            worker->queues[lane] = job_queue_create();
+        }
+        worker->n_fetches = 0;
+        worker->state = WORKER_STATE_RUNNING;
+        // consecutive workers land on neighbouring cpus, wrapping if there are more workers than cpus
+        worker->cpu = _job_system.topology.cpus[i % _job_system.topology.n_cpus];
+        worker->rng = (u32) i * 2654435761u + 1u;
+        worker->thread_fiber = fiber_from_thread();
+        worker->current_fiber = &worker->thread_fiber;
+        worker->n_waiting = 0;
+        worker->scratch_arena = arena_create(options.scratch_size);
+        worker->scratch = &worker->scratch_arena;
+        worker->stats.mark = job_clock_ticks();
+        worker->stats.activity = (i == 0 || i >= _job_system.first_external) ? WORKER_ACTIVITY_OUTSIDE : WORKER_ACTIVITY_IDLE;
+        worker->registered = false;
+        if (options.job_histograms) {
+            worker->stats.histograms = arena_push_array(&_job_system.arena, JobLatencyHistogram, JOB_LATENCY_MAX_FUNCTIONS + 1);
+        }
+        if (_job_system.use_fibers) {
+            worker->fiber_pool = fiber_pool_create(&_job_system.arena, options.fibers_per_worker, options.fiber_stack_size);
+            worker->waiting = arena_push_array(&_job_system.arena, FiberWait, options.fibers_per_worker + 1);
+            worker->fiber_scratch = arena_push_array(&_job_system.arena, Arena, options.fibers_per_worker);
+            for (u32 f = 0; f < options.fibers_per_worker; ++f) {
+                worker->fiber_scratch[f] = arena_create(options.scratch_size);
+            }
+        }
+#if !defined(__gnu_linux__)
+        pthread_mutex_init(&worker->park_mutex, NULL);
+        pthread_cond_init(&worker->park_cond, NULL);
+#endif
+    }
+
+    for (int i = 0; i < _job_system.n_workers; ++i) {
+        worker_build_victims(&_job_system.workers[i]);
+    }
+
+    Worker* main_worker = &_job_system.workers[0];
+    main_worker->thread_id = pthread_self();
+    g_thread_worker = main_worker;
+    g_thread_job_pool = &_job_pool_system.pools[main_worker->index];
+    job_trace_thread_init(main_worker->index);
+    cpu_thread_attr_init(&_job_system.thread_attr);
+    if (options.pin_main_thread) {
+        cpu_pin_thread(main_worker->thread_id, main_worker->cpu.cpu);
+    }
+
+    for (int i = 1; i < _job_system.first_external; ++i) {
+        Worker* worker = &_job_system.workers[i];
+        pthread_create(&worker->thread_id, NULL, worker_proc, (void*)worker);
+        pthread_detach(worker->thread_id);
+        if (options.pin_workers) {
+            cpu_pin_thread(worker->thread_id, worker->cpu.cpu);
+        }
+    }
+
+    if (options.use_timers) {
+        job_timers_start(options.timer_resolution_ns);
+    }
+}
+
+void job_system_init() {
+    job_system_init_with_options(job_system_default_options());
+}
+
+Worker* job_system_find_worker(pthread_t thread_id) {
+    for (i32 i = 0; i < _job_system.n_workers; ++i) {
+        if (pthread_equal(_job_system.workers[i].thread_id, thread_id)) {
+            return &_job_system.workers[i];
+        }
+    }
+    return NULL;
+}
+
+// NULL on threads that are neither workers nor registered
+Worker* job_system_thread_worker() {
+    return g_thread_worker;
+}
+
+// Turns the calling thread (a network or ui thread, say) into a full worker with its own deque, so it
+// can submit, wait and help like worker 0. Returns NULL if every slot is taken.
+Worker* job_system_register_thread() {
+    Assert(g_thread_worker == NULL);
+    for (u32 i = _job_system.first_external; i < _job_system.first_spare; ++i) {
+        Worker* worker = &_job_system.workers[i];
+        i32 expected = false;
+        if (atomic_compare_exchange(&worker->registered, &expected, true)) {
+            worker->thread_id = pthread_self();
+            g_thread_worker = worker;
+            g_thread_job_pool = &_job_pool_system.pools[worker->index];
+            job_trace_thread_init(worker->index);
+            return worker;
+        }
+    }
+    return NULL;
+}
+
+// Scratch memory for the running job, rewound when the job's function returns.
+Arena* job_scratch() {
+    return job_system_thread_worker()->scratch;
+}
+
+// closes the current stretch of activity and starts the next one
+void worker_stats_mark(Worker* worker, WorkerActivity activity) {
+    WorkerStats* stats = &worker->stats;
+    u64 now = job_clock_ticks();
+    if (stats->activity == WORKER_ACTIVITY_BUSY) {
+        job_stat_add(stats->busy_ticks, now - stats->mark);
+    }
+    else if (stats->activity == WORKER_ACTIVITY_IDLE) {
+        job_stat_add(stats->idle_ticks, now - stats->mark);
+    }
+    atomic_store_relaxed(&stats->mark, now);
+    atomic_store_relaxed(&stats->activity, activity);
+}
+
+u64 job_stats_begin() {
+    Worker* worker = g_thread_worker;
+    if (worker == NULL) {
+        return 0;
+    }
+    job_stat_add(worker->stats.jobs_executed, 1);
+    return worker->stats.histograms ? job_clock_ns() : 0;
+}
+
+JobLatencyHistogram* worker_stats_histogram(Worker* worker, JobFunc function) {
+    u64 hash = (IntFromPtr(function) >> 4) * 11400714819323198485ull;
+    for (u32 i = 0; i < JOB_LATENCY_MAX_FUNCTIONS; ++i) {
+        JobLatencyHistogram* histogram = &worker->stats.histograms[(hash + i) & (JOB_LATENCY_MAX_FUNCTIONS - 1)];
+        if (histogram->function == function) {
+            return histogram;
+        }
+        if (histogram->function == NULL) {
+            atomic_store_relaxed(&histogram->function, function);
+            return histogram;
+        }
+    }
+    return &worker->stats.histograms[JOB_LATENCY_MAX_FUNCTIONS];
+}
+
+void job_stats_end(JobFunc function, u64 start) {
+    Worker* worker = g_thread_worker;
+    if (worker == NULL || worker->stats.histograms == NULL) {
+        return;
+    }
+
+    u64 ns = job_clock_ns() - start;
+    u32 bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    JobLatencyHistogram* histogram = worker_stats_histogram(worker, function);
+    job_stat_add(histogram->count, 1);
+    job_stat_add(histogram->total_ns, ns);
+    job_stat_add(histogram->buckets[ClampTop(bucket, JOB_LATENCY_BUCKET_COUNT - 1)], 1);
+    if (ns > histogram->max_ns) {
+        atomic_store_relaxed(&histogram->max_ns, ns);
+    }
+}
+
+// NOTE(bryson): lanes are served highest first, except that every JOB_LANE_ROTATION fetches a lower
+// lane gets to go first (background at the start of the rotation, normal half way through). So
+// background jobs get at least one in JOB_LANE_ROTATION fetches even while higher lanes are never empty.
+#define JOB_LANE_ROTATION 16
+
+void worker_lane_order(Worker* worker, u32 order[JOB_PRIORITY_COUNT]) {
+    u32 tick = worker->n_fetches++ % JOB_LANE_ROTATION;
+    u32 first = JOB_PRIORITY_HIGH;
+    if (tick == 0) first = JOB_PRIORITY_BACKGROUND;
+    else if (tick == JOB_LANE_ROTATION / 2) first = JOB_PRIORITY_NORMAL;
+
+    u32 n = 0;
+    order[n++] = first;
+    for (u32 lane = 0; lane < JOB_PRIORITY_COUNT; ++lane) {
+        if (lane != first) {
+            order[n++] = lane;
+        }
+    }
+}
+
+// jobs queued in all of a worker's lanes
+i64 worker_queue_size(Worker* worker) {
+    i64 size = 0;
+    for (u32 lane = 0; lane < JOB_PRIORITY_COUNT; ++lane) {
+        size += job_queue_size(&worker->queues[lane]);
+    }
+    return size;
+}
+
+Job* worker_steal_from(Worker* worker, u32 victim, u32 lane) {
+    JobQueue* queue = &_job_system.workers[victim].queues[lane];
+    // don't pay for the fence in job_queue_steal on a lane that is empty anyway, the probe still counts
+    // as a failed attempt
+    Job* job = NULL;
+    if (job_queue_size(queue) != 0) {
+        job = job_queue_steal(queue);
+    }
+    job_trace(JOB_TRACE_STEAL, victim, !job_empty(job));
+    job_stat_add(worker->stats.steal_attempts, 1);
+    job_stat_add(worker->stats.steal_successes, !job_empty(job));
+    return job;
+}
+
+// External and spare slots only hold jobs while a thread occupies them (both leave with an empty
+// deque), so they are checked after the real victims and only when taken.
+Job* worker_steal_guests(Worker* worker, u32 lane) {
+    for (u32 i = _job_system.first_external; i < _job_system.n_workers; ++i) {
+        Worker* guest = &_job_system.workers[i];
+        if (guest != worker && atomic_load_relaxed(&guest->registered)) {
+            Job* job = worker_steal_from(worker, i, lane);
+            if (!job_empty(job)) {
+                return job;
+            }
+        }
+    }
+    return NULL;
+}
+
+Job* worker_steal_lane(Worker* worker, u32 lane) {
+    u32 n_victims = worker_victim_count(worker);
+    if (n_victims == 0) {
+        return worker_steal_guests(worker, lane);
+    }
+
+    if (_job_system.steal_policy == STEAL_POLICY_RANDOM) {
+        u32 victim = worker->victims[worker_rand(worker) % n_victims];
+        Job* job = worker_steal_from(worker, victim, lane);
+        return job_empty(job) ? worker_steal_guests(worker, lane) : job;
+    }
+
+    // walk the tiers nearest first, starting each at a random victim so thieves don't pile up
+    u32 tier_start = 0;
+    for (u32 tier = 0; tier < CPU_DISTANCE_COUNT; ++tier) {
+        u32 tier_end = worker->victim_tier_ends[tier];
+        u32 tier_count = tier_end - tier_start;
+        if (tier_count > 0) {
+            u32 offset = worker_rand(worker) % tier_count;
+            for (u32 i = 0; i < tier_count; ++i) {
+                u32 victim = worker->victims[tier_start + (offset + i) % tier_count];
+                Job* job = worker_steal_from(worker, victim, lane);
+                if (!job_empty(job)) {
+                    return job;
+                }
+            }
+        }
+        tier_start = tier_end;
+    }
+    return worker_steal_guests(worker, lane);
+}
+
+Job* worker_steal(Worker* worker, u32 order[JOB_PRIORITY_COUNT]) {
+    for (u32 i = 0; i < JOB_PRIORITY_COUNT; ++i) {
+        Job* job = worker_steal_lane(worker, order[i]);
+        if (!job_empty(job)) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+Job* worker_pop(Worker* worker, u32 order[JOB_PRIORITY_COUNT]) {
+    for (u32 i = 0; i < JOB_PRIORITY_COUNT; ++i) {
+        JobQueue* queue = &worker->queues[order[i]];
+        // popping an empty lane still costs a fence, only the owner pushes so this can't miss a job
+        if (job_queue_size(queue) == 0) {
+            continue;
+        }
+        Job* job = job_queue_pop(queue);
+        if (!job_empty(job)) {
+            job_stat_add(worker->stats.local_pops, 1);
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// Pushes runs of jobs with the same priority with one reservation each. Returns how many jobs fit,
+// stopping at the first lane that is full.
+u32 worker_push_batch(Worker* worker, Job** jobs, u32 count) {
+    u32 n_pushed = 0;
+    while (n_pushed < count) {
+        u32 lane = jobs[n_pushed]->priority;
+        u32 run = 1;
+        while (n_pushed + run < count && jobs[n_pushed + run]->priority == lane) {
+            ++run;
+        }
+
+        u32 n = job_queue_push_batch(&worker->queues[lane], jobs + n_pushed, run);
+        n_pushed += n;
+        if (n < run) {
+            break;
+        }
+    }
+    return n_pushed;
+}
+
+// jobs a worker moves from the injection queue into its deque in one go, for others to steal
+#define WORKER_INJECTION_BATCH 16
+// fetches between two checks of the injection queue while the worker's own lanes aren't empty
+#define WORKER_INJECTION_INTERVAL 32
+
+void job_system_wake_worker(Worker* near);
+
+// Takes the oldest injected job and moves up to WORKER_INJECTION_BATCH more into the worker's lanes.
+Job* worker_drain_injection(Worker* worker) {
+    // only take what fits into any lane, so the batch can't fail half way
+    i64 room = MAX_JOB_COUNT;
+    for (u32 lane = 0; lane < JOB_PRIORITY_COUNT; ++lane) {
+        room = Min(room, MAX_JOB_COUNT - job_queue_size(&worker->queues[lane]));
+    }
+
+    Job* jobs[1 + WORKER_INJECTION_BATCH];
+    u32 n_jobs = job_injection_queue_drain(&_job_system.injection, jobs, 1 + (u32) Min(room, WORKER_INJECTION_BATCH));
+    if (n_jobs == 0) {
+        return NULL;
+    }
+
+    if (n_jobs > 1) {
+        worker_push_batch(worker, jobs + 1, n_jobs - 1);
+        // let somebody help with the rest of the batch
+        job_system_wake_worker(worker);
+    }
+    return jobs[0];
+}
+
+Job* worker_find_job(Worker* worker) {
+    u32 order[JOB_PRIORITY_COUNT];
+    worker_lane_order(worker, order);
+
+    // every so often the injection queue goes first, so jobs from other threads, timers and I/O aren't
+    // held up by a worker that keeps refilling its own deque
+    b32 injection_first = worker->n_fetches % WORKER_INJECTION_INTERVAL == 0;
+    Job* job = injection_first ? worker_drain_injection(worker) : NULL;
+    if (job_empty(job)) {
+        job = worker_pop(worker, order);
+    }
+    if (job_empty(job) && !injection_first) {
+        job = worker_drain_injection(worker);
+    }
+    if (job_empty(job)) {
+        job = worker_steal(worker, order);
+    }
+
+    // nothing to steal either. Callers spin with worker_backoff and only yield or park once that ran out.
+    return job;
+}
+
+// A job whose group was cancelled is completed on the spot instead of running, which still releases its
+// parent and continuations. Returns true if the job was dropped.
+b32 worker_drop_cancelled(Worker* worker, Job* job) {
+    if (!job_cancelled(job)) {
+        return false;
+    }
+    job_stat_add(worker->stats.jobs_cancelled, 1);
+    job_finish(job);
+    return true;
+}
+
+Job* worker_get_job(Worker* worker) {
+    for (;;) {
+        Job* job = worker_find_job(worker);
+        if (job_empty(job) || !worker_drop_cancelled(worker, job)) {
+            return job;
+        }
+    }
+}
+
+Fiber* worker_take_ready_fiber(Worker* worker) {
+    for (u32 i = 0; i < worker->n_waiting; ++i) {
+        if (fiber_wait_over(&worker->waiting[i])) {
+            Fiber* fiber = worker->waiting[i].fiber;
+            worker->waiting[i] = worker->waiting[--worker->n_waiting];
+            return fiber;
+        }
+    }
+    return NULL;
+}
+
+void worker_switch_fiber(Worker* worker, Fiber* next) {
+    Fiber* prev = worker->current_fiber;
+    worker->current_fiber = next;
+    // a suspended job keeps its scratch allocations, so every fiber gets its own arena
+    u64 fiber_index = next - worker->fiber_pool.fibers;
+    worker->scratch = (next == &worker->thread_fiber) ? &worker->scratch_arena : &worker->fiber_scratch[fiber_index];
+    fiber_switch_to(prev, next);
+}
+
+void worker_fiber_proc(void* arg);
+
+// Suspends the calling context until the wait is over and runs other work on another fiber in the
+// meantime. Returns false if the worker is out of fibers, the caller has to help while waiting then.
+b32 worker_fiber_wait(Worker* worker, FiberWait wait) {
+    Fiber* next = worker_take_ready_fiber(worker);
+    if (next == NULL) {
+        next = fiber_pool_acquire(&worker->fiber_pool, worker_fiber_proc, worker);
+        if (next == NULL) {
+            return false;
+        }
+    }
+
+    wait.fiber = worker->current_fiber;
+    worker->waiting[worker->n_waiting++] = wait;
+    worker_switch_fiber(worker, next);
+    return true;
+}
+
+// Switches to a suspended fiber whose job completed. The calling fiber goes back to the pool and
+// starts from the top the next time it is handed out, so this does not return if a fiber was ready.
+void worker_resume_ready_fiber(Worker* worker) {
+    Fiber* ready = worker_take_ready_fiber(worker);
+    if (ready != NULL) {
+        // the resumed fiber carries on with its job
+        worker_stats_mark(worker, WORKER_ACTIVITY_BUSY);
+        fiber_pool_release(&worker->fiber_pool, worker->current_fiber);
+        worker_switch_fiber(worker, ready);
+    }
+}
+
+void worker_backoff(u32 spin);
+
+void worker_wait_for(Worker* worker, FiberWait wait) {
+    if (fiber_wait_over(&wait)) {
+        return;
+    }
+
+    // waiting inside a job keeps the worker busy, a thread waiting from its own code is idle
+    // while it waits and busy while it helps
+    b32 outside = worker->stats.activity == WORKER_ACTIVITY_OUTSIDE;
+    if (outside) {
+        worker_stats_mark(worker, WORKER_ACTIVITY_IDLE);
+    }
+
+    if (!(_job_system.use_fibers && worker == g_thread_worker && worker_fiber_wait(worker, wait))) {
+        u32 spin = 0;
+        while(!fiber_wait_over(&wait)) {
+            Job* next_job = worker_get_job(worker);
+            if (!job_empty(next_job)) {
+                if (outside) {
+                    worker_stats_mark(worker, WORKER_ACTIVITY_BUSY);
+                }
+                job_execute(next_job);
+                if (outside) {
+                    worker_stats_mark(worker, WORKER_ACTIVITY_IDLE);
+                }
+                spin = 0;
+            }
+            else if (spin < WORKER_SPIN_COUNT) {
+                worker_backoff(spin++);
+            }
+            else {
+                yield();
+            }
+        }
+    }
+
+    if (outside) {
+        worker_stats_mark(worker, WORKER_ACTIVITY_OUTSIDE);
+    }
+}
+
+void worker_wait_handle(Worker* worker, JobHandle handle) {
+    FiberWait wait = {
+        .fiber = NULL,
+        .handle = handle,
+        .ready = NULL,
+        .ready_arg = NULL,
+    };
+    worker_wait_for(worker, wait);
+}
+
+// NOTE(bryson): finished jobs go straight back to their pool, so the job must not have been
+// recycled yet. Waiting before the calling thread creates another job is enough, otherwise take a
+// JobHandle up front and use worker_wait_handle.
+void worker_wait(Worker* worker, Job* job) {
+    JobHandle handle = {
+        .job = job,
+        .generation = atomic_load_acquire(&job->generation),
+    };
+    worker_wait_handle(worker, handle);
+}
+
+b32 job_system_has_work() {
+    if (!job_injection_queue_empty(&_job_system.injection)) {
+        return true;
+    }
+    for (u32 i = 0; i < _job_system.n_workers; ++i) {
+        if (worker_queue_size(&_job_system.workers[i]) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void worker_park_wait(Worker* worker) {
+#if defined(__gnu_linux__)
+    while (atomic_load_acquire(&worker->state) == WORKER_STATE_PARKED) {
+        syscall(SYS_futex, &worker->state, FUTEX_WAIT_PRIVATE, WORKER_STATE_PARKED, NULL, NULL, 0);
+    }
+#else
+    pthread_mutex_lock(&worker->park_mutex);
+    while (atomic_load_acquire(&worker->state) == WORKER_STATE_PARKED) {
+        pthread_cond_wait(&worker->park_cond, &worker->park_mutex);
+    }
+    pthread_mutex_unlock(&worker->park_mutex);
+#endif
+}
+
+void worker_park_notify(Worker* worker) {
+#if defined(__gnu_linux__)
+    syscall(SYS_futex, &worker->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&worker->park_mutex);
+    pthread_cond_signal(&worker->park_cond);
+    pthread_mutex_unlock(&worker->park_mutex);
+#endif
+}
+
+// NOTE(bryson): a parked worker is only ever woken by whoever flips its state back to running, so
+// exactly one thread decrements n_sleeping per park.
+b32 worker_try_unpark(Worker* worker) {
+    i32 expected = WORKER_STATE_PARKED;
+    if (atomic_compare_exchange(&worker->state, &expected, WORKER_STATE_RUNNING)) {
+        atomic_decrement(&_job_system.n_sleeping);
+        return true;
+    }
+    return false;
+}
+
+void worker_park(Worker* worker) {
+    atomic_store_release(&worker->state, WORKER_STATE_PARKED);
+    atomic_increment(&_job_system.n_sleeping);
+
+    // pairs with the fence in job_system_wake_worker: either we see the new job here or the
+    // submitter sees us sleeping
+    atomic_fence_seq_cst();
+    if (job_system_has_work()) {
+        if (worker_try_unpark(worker)) {
+            return;
+        }
+    }
+
+    job_trace(JOB_TRACE_PARK, 0, 0);
+    worker_park_wait(worker);
+    job_trace(JOB_TRACE_UNPARK, 0, 0);
+}
+
+// wakes up to count sleeping workers, closest to the passed one (by cpu topology) first. Does
+// nothing if nobody is asleep.
+void job_system_wake_workers(Worker* near, u32 count) {
+    atomic_fence_seq_cst();
+    if (atomic_load_relaxed(&_job_system.n_sleeping) == 0) {
+        return;
+    }
+
+    // victims are ordered by distance, so the first parked one is the closest to the submitter
+    u32 n_woken = 0;
+    u32 n_own = near ? worker_victim_count(near) : _job_system.first_external;
+    for (u32 i = 0; i < n_own && n_woken < count; ++i) {
+        Worker* worker = &_job_system.workers[near ? near->victims[i] : i];
+        if (worker_try_unpark(worker)) {
+            worker_park_notify(worker);
+            n_woken += 1;
+        }
+    }
+
+    // active spares park like any worker once they run out of jobs, empty slots are skipped
+    for (u32 i = _job_system.first_external; i < _job_system.n_workers && n_woken < count; ++i) {
+        Worker* worker = &_job_system.workers[i];
+        if (atomic_load_relaxed(&worker->registered) && worker_try_unpark(worker)) {
+            worker_park_notify(worker);
+            n_woken += 1;
+        }
+    }
+}
+
+void job_system_wake_worker(Worker* near) {
+    job_system_wake_workers(near, 1);
+}
+
+void worker_poll() {
+    job_system_wake_worker(job_system_thread_worker());
+    yield();
+}
+
+// NOTE(bryson): only thieves take jobs out of a full deque while its owner is submitting, and there
+// may be none (a single worker, or everybody busy). So the owner makes room by running the newest job
+// itself.
+void worker_make_room(Worker* worker) {
+    job_trace(JOB_TRACE_SUBMIT_RETRY, 0, 0);
+    job_system_wake_worker(worker);
+    u32 order[JOB_PRIORITY_COUNT];
+    worker_lane_order(worker, order);
+    Job* job = worker_pop(worker, order);
+    if (!job_empty(job) && !worker_drop_cancelled(worker, job)) {
+        job_execute(job);
+    }
+}
+
+void worker_record_queue_depth(Worker* worker) {
+    u64 depth = (u64) worker_queue_size(worker);
+    if (depth > worker->stats.max_queue_depth) {
+        atomic_store_relaxed(&worker->stats.max_queue_depth, depth);
+    }
+}
+
+void worker_submit(Worker* worker, Job* job) {
+    job_assert_live(job);
+    while(!job_queue_push(&worker->queues[job->priority], job)) {
+        worker_make_room(worker);
+    };
+    worker_record_queue_depth(worker);
+    job_system_wake_worker(worker);
+}
+
+// Submits count jobs with one reservation and one publish per run of equal priority (more if they
+// don't all fit) and wakes at most one sleeping worker per job.
+void worker_submit_batch(Worker* worker, Job** jobs, u32 count) {
+#if DEBUG
+    for (u32 i = 0; i < count; ++i) {
+        job_assert_live(jobs[i]);
+    }
+#endif
+
+    // jobs published so far that nobody was woken for yet
+    u32 n_submitted = 0;
+    u32 n_unwoken = 0;
+    while (n_submitted < count) {
+        u32 n_pushed = worker_push_batch(worker, jobs + n_submitted, count - n_submitted);
+        n_submitted += n_pushed;
+        n_unwoken += n_pushed;
+        if (n_submitted < count) {
+            // thieves have to drain the full deque before the rest fits
+            job_system_wake_workers(worker, n_unwoken);
+            n_unwoken = 0;
+            worker_make_room(worker);
+        }
+    }
+    worker_record_queue_depth(worker);
+    if (n_unwoken > 0) {
+        job_system_wake_workers(worker, n_unwoken);
+    }
+}
+
+// Submits from any thread. Workers push into their own deque, every other thread goes through the
+// injection queue.
+void job_system_submit(Job* job) {
+    Worker* worker = g_thread_worker;
+    if (worker != NULL) {
+        worker_submit(worker, job);
+        return;
+    }
+
+    job_injection_queue_push(&_job_system.injection, job);
+    job_system_wake_worker(NULL);
+}
+
+// Waits from any thread. Workers help with other jobs in the meantime, other threads just spin and
+// then yield.
+void job_system_wait(JobHandle handle) {
+    Worker* worker = g_thread_worker;
+    if (worker != NULL) {
+        worker_wait_handle(worker, handle);
+        return;
+    }
+
+    u32 spin = 0;
+    while (!job_handle_completed(handle)) {
+        if (spin < WORKER_SPIN_COUNT) {
+            worker_backoff(spin++);
+        }
+        else {
+            yield();
+        }
+    }
+}
+
+// Waits until ready(arg) returns true, for conditions that aren't a job completing. A worker suspends
+// its fiber or runs other jobs in the meantime, just like job_system_wait, and checks ready between
+// jobs. ready has to be cheap and callable from any thread.
+void job_system_wait_until(JobReadyFunc ready, void* arg) {
+    Worker* worker = g_thread_worker;
+    if (worker != NULL) {
+        FiberWait wait = {
+            .fiber = NULL,
+            .handle = {0},
+            .ready = ready,
+            .ready_arg = arg,
+        };
+        worker_wait_for(worker, wait);
+        return;
+    }
+
+    u32 spin = 0;
+    while (!ready(arg)) {
+        if (spin < WORKER_SPIN_COUNT) {
+            worker_backoff(spin++);
+        }
+        else {
+            yield();
+        }
+    }
+}
+
+// Gives the calling thread's worker slot back. Jobs still in its deque are run first, so nothing it
+// submitted is left behind without an owner.
+void job_system_unregister_thread() {
+    Worker* worker = g_thread_worker;
+    Assert(worker != NULL && worker->index >= _job_system.first_external && worker->index < _job_system.first_spare);
+
+    u32 order[JOB_PRIORITY_COUNT];
+    worker_lane_order(worker, order);
+    for (Job* job = worker_pop(worker, order); !job_empty(job); job = worker_pop(worker, order)) {
+        if (!worker_drop_cancelled(worker, job)) {
+            job_execute(job);
+        }
+    }
+
+    g_thread_worker = NULL;
+    g_thread_job_pool = NULL;
+    atomic_store_release(&worker->registered, false);
+}
+
+// NOTE(bryson): a worker blocked in a syscall, a lock or sqlite3_step still holds its core as far as the
+// job system knows. job_blocking_begin hands the core to a spare worker, waking an idle spare or starting
+// a thread in a free spare slot. Spares check before every job whether more of them run than workers
+// block. The ones that aren't needed wait to be activated again and exit after spare_retire_ns.
+thread_local u32 g_blocking_depth = 0;
+
+// called with spare_lock held
+void job_system_activate_spares() {
+    while (atomic_load_acquire(&_job_system.n_active_spares) < atomic_load_acquire(&_job_system.n_blocking)) {
+        if (_job_system.n_idle_spares > _job_system.n_spare_wakeups) {
+            _job_system.n_spare_wakeups += 1;
+            atomic_increment(&_job_system.n_active_spares);
+            pthread_cond_signal(&_job_system.spare_cond);
+            continue;
+        }
+
+        Worker* spare = NULL;
+        for (u32 i = _job_system.first_spare; i < _job_system.n_workers && spare == NULL; ++i) {
+            if (!atomic_load_acquire(&_job_system.workers[i].registered)) {
+                spare = &_job_system.workers[i];
+            }
+        }
+        if (spare == NULL) {
+            // every slot is taken, the core stays idle until somebody unblocks
+            return;
+        }
+        atomic_store_release(&spare->registered, true);
+        atomic_increment(&_job_system.n_active_spares);
+        pthread_create(&spare->thread_id, &_job_system.thread_attr, worker_proc, (void*) spare);
+        pthread_detach(spare->thread_id);
+    }
+}
+
+// Call from a job right before it blocks the thread outside of the job system (a syscall, a lock,
+// sqlite3_step) and job_blocking_end once it is back. Pairs nest, only the outermost one counts. Does
+// nothing on threads that aren't workers.
+void job_blocking_begin() {
+    if (g_thread_worker == NULL || g_blocking_depth++ > 0) {
+        return;
+    }
+
+    i32 n_blocking = atomic_increment(&_job_system.n_blocking) + 1;
+    b32 has_spares = _job_system.first_spare < _job_system.n_workers;
+    if (has_spares && atomic_load_acquire(&_job_system.n_active_spares) < n_blocking) {
+        pthread_mutex_lock(&_job_system.spare_lock);
+        job_system_activate_spares();
+        pthread_mutex_unlock(&_job_system.spare_lock);
+    }
+}
+
+void job_blocking_end() {
+    if (g_thread_worker == NULL || --g_blocking_depth > 0) {
+        return;
+    }
+
+    i32 n_blocking = atomic_decrement(&_job_system.n_blocking) - 1;
+    if (atomic_load_acquire(&_job_system.n_active_spares) > n_blocking) {
+        // a spare parked for lack of work wouldn't notice that it isn't needed anymore
+        for (u32 i = _job_system.first_spare; i < _job_system.n_workers; ++i) {
+            Worker* spare = &_job_system.workers[i];
+            if (worker_try_unpark(spare)) {
+                worker_park_notify(spare);
+                return;
+            }
+        }
+    }
+}
+
+// Takes the calling spare out of the active count if more spares run than workers block.
+b32 worker_spare_surplus(Worker* worker) {
+    i32 n_active = atomic_load_acquire(&_job_system.n_active_spares);
+    while (n_active > atomic_load_acquire(&_job_system.n_blocking)) {
+        if (atomic_compare_exchange(&_job_system.n_active_spares, &n_active, n_active - 1)) {
+            // pairs with job_blocking_begin, which counts blocking workers before it counts spares. A worker
+            // that started blocking in between may have counted on us, so we stay.
+            if (atomic_load_acquire(&_job_system.n_blocking) >= n_active) {
+                atomic_increment(&_job_system.n_active_spares);
+                return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Waits until job_blocking_begin needs the spare again. Returns false if that didn't happen within
+// spare_retire_ns, the spare's thread exits then.
+b32 worker_spare_idle(Worker* worker) {
+    worker_stats_mark(worker, WORKER_ACTIVITY_OUTSIDE);
+    pthread_mutex_lock(&_job_system.spare_lock);
+    _job_system.n_idle_spares += 1;
+
+    struct timespec deadline = job_clock_deadline(_job_system.spare_retire_ns);
+    i32 result = 0;
+    while (_job_system.n_spare_wakeups == 0 && result != ETIMEDOUT) {
+        result = pthread_cond_timedwait(&_job_system.spare_cond, &_job_system.spare_lock, &deadline);
+    }
+
+    _job_system.n_idle_spares -= 1;
+    b32 activated = _job_system.n_spare_wakeups > 0;
+    if (activated) {
+        _job_system.n_spare_wakeups -= 1;
+    }
+    pthread_mutex_unlock(&_job_system.spare_lock);
+
+    if (activated) {
+        worker_stats_mark(worker, WORKER_ACTIVITY_IDLE);
+    }
+    return activated;
+}
+
+void worker_backoff(u32 spin) {
+    u32 n_relax = 1u << ClampTop(spin, 6);
+    for (u32 i = 0; i < ClampTop(n_relax, WORKER_MAX_BACKOFF); ++i) {
+        cpu_relax();
+    }
+}
+
+// Runs jobs until the thread exits, which only spare workers do.
+void worker_loop(Worker* worker) {
+    b32 spare = worker->index >= _job_system.first_spare;
+    u32 spin = 0;
+    for(;;) {
+        if (worker->n_waiting > 0) {
+            worker_resume_ready_fiber(worker);
+        }
+
+        // a spare that isn't needed anymore finishes its own jobs, then stops taking new ones
+        if (spare && worker->n_waiting == 0 && worker_queue_size(worker) == 0 && worker_spare_surplus(worker)) {
+            if (!worker_spare_idle(worker)) {
+                return;
+            }
+            spin = 0;
+            continue;
+        }
+
+        Job* job = worker_get_job(worker);
+        if (!job_empty(job)) {
+            worker_stats_mark(worker, WORKER_ACTIVITY_BUSY);
+            job_execute(job);
+            worker_stats_mark(worker, WORKER_ACTIVITY_IDLE);
+            spin = 0;
+        }
+        else if (spin < WORKER_SPIN_COUNT) {
+            worker_backoff(spin++);
+        }
+        else if (worker->n_waiting == 0) {
+            worker_park(worker);
+            spin = 0;
+        }
+        else {
+            // suspended fibers are only resumed by this worker, so it can't go to sleep on them
+            yield();
+        }
+    }
+}
+
+void worker_fiber_proc(void* arg) {
+    Worker* worker = (Worker*) arg;
+    worker_loop(worker);
+    // a retiring spare, finish on the thread's own stack
+    fiber_pool_release(&worker->fiber_pool, worker->current_fiber);
+    worker_switch_fiber(worker, &worker->thread_fiber);
+}
+
+void* worker_proc(void* arg) {
+    Worker* worker = (Worker*) arg;
+    g_thread_worker = worker;
+    g_thread_job_pool = &_job_pool_system.pools[worker->index];
+    job_trace_thread_init(worker->index);
+    // spare slots are taken over by a new thread every time a spare starts
+    worker->current_fiber = &worker->thread_fiber;
+    worker->scratch = &worker->scratch_arena;
+    b32 spare = worker->index >= _job_system.first_spare;
+    if (spare) {
+        worker_stats_mark(worker, WORKER_ACTIVITY_IDLE);
+    }
+
+    if (_job_system.use_fibers) {
+        worker_switch_fiber(worker, fiber_pool_acquire(&worker->fiber_pool, worker_fiber_proc, worker));
+    }
+    else {
+        worker_loop(worker);
+    }
+
+    if (spare) {
+        // from here on the slot can be handed to the next spare
+        atomic_store_release(&worker->registered, false);
+    }
+    return NULL;
+}
+
+// Counters of a single worker since job_system_init. Safe to call from any thread at any time.
+JobSystemStats job_worker_stats(u32 index) {
+    Worker* worker = &_job_system.workers[index];
+    WorkerStats* stats = &worker->stats;
+    JobSystemStats result = {
+        .jobs_executed = atomic_load_relaxed(&stats->jobs_executed),
+        .jobs_cancelled = atomic_load_relaxed(&stats->jobs_cancelled),
+        .local_pops = atomic_load_relaxed(&stats->local_pops),
+        .steal_attempts = atomic_load_relaxed(&stats->steal_attempts),
+        .steal_successes = atomic_load_relaxed(&stats->steal_successes),
+        .max_queue_depth = atomic_load_relaxed(&stats->max_queue_depth),
+    };
+
+    // include the stretch the worker is in right now, otherwise a worker that has been parked since
+    // the last sample shows no idle time
+    u64 idle_ticks = atomic_load_relaxed(&stats->idle_ticks);
+    u64 busy_ticks = atomic_load_relaxed(&stats->busy_ticks);
+    u64 mark = atomic_load_relaxed(&stats->mark);
+    u32 activity = atomic_load_relaxed(&stats->activity);
+    u64 now = job_clock_ticks();
+    if (now > mark && activity == WORKER_ACTIVITY_IDLE) idle_ticks += now - mark;
+    if (now > mark && activity == WORKER_ACTIVITY_BUSY) busy_ticks += now - mark;
+
+    f64 ns_per_tick = job_clock_ns_per_tick();
+    result.idle_ns = (u64) ((f64) idle_ticks * ns_per_tick);
+    result.busy_ns = (u64) ((f64) busy_ticks * ns_per_tick);
+    return result;
+}
+
+void job_stats_finalize(JobSystemStats* stats) {
+    stats->steal_success_rate = stats->steal_attempts ? (f64) stats->steal_successes / (f64) stats->steal_attempts : 0.0;
+    u64 total_ns = stats->idle_ns + stats->busy_ns;
+    stats->idle_ratio = total_ns ? (f64) stats->idle_ns / (f64) total_ns : 0.0;
+}
+
+// Counters of every worker added up, max_queue_depth is the maximum over all workers.
+JobSystemStats job_system_stats() {
+    JobSystemStats total = {0};
+    for (u32 i = 0; i < _job_system.n_workers; ++i) {
+        JobSystemStats stats = job_worker_stats(i);
+        total.jobs_executed += stats.jobs_executed;
+        total.jobs_cancelled += stats.jobs_cancelled;
+        total.local_pops += stats.local_pops;
+        total.steal_attempts += stats.steal_attempts;
+        total.steal_successes += stats.steal_successes;
+        total.max_queue_depth = Max(total.max_queue_depth, stats.max_queue_depth);
+        total.idle_ns += stats.idle_ns;
+        total.busy_ns += stats.busy_ns;
+    }
+    job_stats_finalize(&total);
+    return total;
+}
+
+// Merges the latency histograms of every worker into out, one entry per JobFunc, and returns the
+// number of entries written. Returns 0 unless the system was initialized with job_histograms.
+u32 job_system_latency_histograms(JobLatencyHistogram* out, u32 max_histograms) {
+    u32 n_out = 0;
+    for (u32 w = 0; w < _job_system.n_workers; ++w) {
+        JobLatencyHistogram* histograms = _job_system.workers[w].stats.histograms;
+        if (histograms == NULL) {
+            return 0;
+        }
+
+        for (u32 h = 0; h <= JOB_LATENCY_MAX_FUNCTIONS; ++h) {
+            JobLatencyHistogram* histogram = &histograms[h];
+            u64 count = atomic_load_relaxed(&histogram->count);
+            if (count == 0) {
+                continue;
+            }
+
+            JobFunc function = atomic_load_relaxed(&histogram->function);
+            JobLatencyHistogram* merged = NULL;
+            for (u32 i = 0; i < n_out; ++i) {
+                if (out[i].function == function) {
+                    merged = &out[i];
+                    break;
+                }
+            }
+            if (merged == NULL) {
+                if (n_out == max_histograms) {
+                    continue;
+                }
+                merged = &out[n_out++];
+                MemoryZeroStruct(merged);
+                merged->function = function;
+            }
+
+            merged->count += count;
+            merged->total_ns += atomic_load_relaxed(&histogram->total_ns);
+            merged->max_ns = Max(merged->max_ns, atomic_load_relaxed(&histogram->max_ns));
+            for (u32 b = 0; b < JOB_LATENCY_BUCKET_COUNT; ++b) {
+                merged->buckets[b] += atomic_load_relaxed(&histogram->buckets[b]);
+            }
+        }
+    }
+    return n_out;
+}
+
+// upper bound in ns of the bucket holding the given percentile (0-100)
+u64 job_latency_percentile(JobLatencyHistogram* histogram, f64 percentile) {
+    u64 target = (u64) ((f64) histogram->count * percentile / 100.0);
+    u64 seen = 0;
+    for (u32 b = 0; b < JOB_LATENCY_BUCKET_COUNT; ++b) {
+        seen += histogram->buckets[b];
+        if (seen > target || seen == histogram->count) {
+            return b == JOB_LATENCY_BUCKET_COUNT - 1 ? histogram->max_ns : (1ull << b);
+        }
+    }
+    return histogram->max_ns;
+}
+#pragma endregion
+
+#pragma region timers
+// NOTE(bryson): all timers share one wheel behind a mutex. A dedicated thread sleeps until the next tick
+// that has work, or until somebody adds a timer that fires sooner. Expired jobs go through the
+// injection queue, so they end up in the workers' deques at their priority like any other job.
+static struct {
+    TimerWheel wheel;
+    u64 resolution_ns;
+    // tick the timer thread sleeps until, TIMER_TICK_NONE while the wheel is empty
+    u64 wake_tick;
+    b32 running;
+    pthread_t thread_id;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} _job_timers;
+
+u64 job_timer_now() {
+    return job_clock_ns() / _job_timers.resolution_ns;
+}
+
+// Called with the lock held. A one-shot timer submits its job. A periodic timer submits a copy of its
+// job as a child of it and goes back into the wheel.
+void job_timer_fire(JobTimerEntry* entry) {
+    Job* job = entry->job;
+    if (entry->period == 0) {
+        timer_wheel_free(&_job_timers.wheel, entry);
+        job_injection_queue_push(&_job_system.injection, job);
+        return;
+    }
+
+    Job* run = job_create_child(job, job->function);
+    MemoryCopy(run->data, job->data, JOB_DATA_SIZE);
+    if (job->payload != NULL) {
+        job_payload_retain(job->payload);
+        run->payload = job->payload;
+    }
+    job_injection_queue_push(&_job_system.injection, run);
+
+    // runs that were missed are skipped, the timer keeps its phase
+    do {
+        entry->expiry += entry->period;
+    } while (entry->expiry <= _job_timers.wheel.current);
+    timer_wheel_insert(&_job_timers.wheel, entry);
+}
+
+void* job_timer_proc(void* arg) {
+    pthread_mutex_lock(&_job_timers.lock);
+    for (;;) {
+        u32 n_expired = 0;
+        JobTimerEntry* entry = timer_wheel_advance(&_job_timers.wheel, job_timer_now());
+        while (entry != NULL) {
+            JobTimerEntry* next = entry->next;
+            job_timer_fire(entry);
+            n_expired += 1;
+            entry = next;
+        }
+        if (n_expired > 0) {
+            job_system_wake_workers(NULL, n_expired);
+        }
+
+        u64 next_tick = timer_wheel_next_tick(&_job_timers.wheel);
+        _job_timers.wake_tick = next_tick;
+        if (next_tick == TIMER_TICK_NONE) {
+            pthread_cond_wait(&_job_timers.cond, &_job_timers.lock);
+            continue;
+        }
+
+        u64 now = job_clock_ns();
+        u64 wake = next_tick * _job_timers.resolution_ns;
+        if (wake > now) {
+            // a jump of the realtime clock just makes us recheck early or late
+            struct timespec deadline = job_clock_deadline(wake - now);
+            pthread_cond_timedwait(&_job_timers.cond, &_job_timers.lock, &deadline);
+        }
+    }
+    return NULL;
+}
+
+void job_timers_start(u64 resolution_ns) {
+    _job_timers.resolution_ns = ClampBot(resolution_ns, 1);
+    timer_wheel_init(&_job_timers.wheel, job_timer_now());
+    _job_timers.wake_tick = TIMER_TICK_NONE;
+    pthread_mutex_init(&_job_timers.lock, NULL);
+    pthread_cond_init(&_job_timers.cond, NULL);
+    _job_timers.running = true;
+    pthread_create(&_job_timers.thread_id, &_job_system.thread_attr, job_timer_proc, NULL);
+    pthread_detach(_job_timers.thread_id);
+}
+
+JobTimer job_timer_add(Job* job, u64 delay_ns, u64 period_ns) {
+    job_assert_live(job);
+    // jobs are queued through the injection queue, which links them through continuation_link
+    Assert(job->continuation_link.job == NULL);
+    Assert(_job_timers.running);
+    u64 resolution = _job_timers.resolution_ns;
+    TimerWheel* wheel = &_job_timers.wheel;
+
+    pthread_mutex_lock(&_job_timers.lock);
+    // nothing is pending, so the ticks the wheel slept through can simply be skipped
+    u64 now = job_timer_now();
+    if (timer_wheel_empty(wheel)) {
+        wheel->current = Max(wheel->current, now);
+    }
+
+    JobTimerEntry* entry = timer_wheel_alloc(wheel);
+    entry->job = job;
+    entry->period = period_ns ? ClampBot((period_ns + resolution - 1) / resolution, 1) : 0;
+    // rounded up, so a timer never fires early. One that is already due fires on the next tick.
+    u64 expiry = (job_clock_ns() + delay_ns + resolution - 1) / resolution;
+    entry->expiry = Max(expiry, wheel->current + 1);
+    timer_wheel_insert(wheel, entry);
+
+    if (entry->expiry < _job_timers.wake_tick) {
+        pthread_cond_signal(&_job_timers.cond);
+    }
+    JobTimer timer = {
+        .entry = entry,
+        .generation = entry->generation,
+    };
+    pthread_mutex_unlock(&_job_timers.lock);
+    return timer;
+}
+
+// Submits job once delay_ns have passed. Can be called from any thread.
+JobTimer job_submit_after(Job* job, u64 delay_ns) {
+    return job_timer_add(job, delay_ns, 0);
+}
+
+// Runs a copy of job every period_ns, starting one period from now. job itself never runs, every run
+// is a child of it with a copy of its data (payloads are shared), so waiting on job returns once the
+// timer was cancelled and the runs already submitted completed.
+JobTimer job_submit_every(Job* job, u64 period_ns) {
+    Assert(period_ns > 0);
+    return job_timer_add(job, period_ns, period_ns);
+}
+
+// Returns false if the timer already fired (one-shot) or was cancelled before. A cancelled job
+// completes without running, which still finishes its parent and submits its continuations.
+b32 job_timer_cancel(JobTimer timer) {
+    pthread_mutex_lock(&_job_timers.lock);
+    JobTimerEntry* entry = timer.entry;
+    if (entry->generation != timer.generation) {
+        pthread_mutex_unlock(&_job_timers.lock);
+        return false;
+    }
+
+    Job* job = entry->job;
+    timer_wheel_remove(&_job_timers.wheel, entry);
+    timer_wheel_free(&_job_timers.wheel, entry);
+    pthread_mutex_unlock(&_job_timers.lock);
+
+    job_finish(job);
+    return true;
+}
+#pragma endregion
+
+#pragma region job_graph
+// NOTE(bryson): a task graph that is built up front and submitted once. Nodes are regular jobs,
+// children of the graph's root, so waiting on the handle returned by job_graph_submit waits on the
+// whole graph. A node is pushed by whichever worker finishes its last predecessor, nobody blocks.
+// Edges live in the graph's arena, which has to outlive the graph's execution.
+typedef struct JobGraphNode {
+    Job* job;
+    u32 n_predecessors;
+    struct JobGraphNode* next;
+} JobGraphNode;
+
+typedef struct JobGraph {
+    Arena* arena;
+    Job* root;
+    JobGraphNode* nodes;
+    u32 n_nodes;
+} JobGraph;
+
+void job_graph_root_job(Job* job, void* data) {}
+
+JobGraph job_graph_create(Arena* arena) {
+    JobGraph graph = {
+        .arena = arena,
+        .root = job_create(&job_graph_root_job),
+        .nodes = NULL,
+        .n_nodes = 0,
+    };
+    return graph;
+}
+
+JobGraphNode* job_graph_add(JobGraph* graph, JobFunc function, char* data, u32 size) {
+    JobGraphNode* node = arena_push(graph->arena, JobGraphNode);
+    node->job = job_create_child(graph->root, function);
+    if (data != NULL) {
+        job_write_data(node->job, data, size);
+    }
+    node->n_predecessors = 0;
+    node->next = graph->nodes;
+    graph->nodes = node;
+    graph->n_nodes += 1;
+    return node;
+}
+
+// after runs once before (and its children) completed
+void job_graph_depend(JobGraph* graph, JobGraphNode* before, JobGraphNode* after) {
+    JobContinuation* edge = arena_push(graph->arena, JobContinuation);
+    edge->job = after->job;
+    job_push_continuation(before->job, edge);
+    after->n_predecessors += 1;
+}
+
+// Pushes every node without predecessors onto worker. The graph must not be changed afterwards.
+JobHandle job_graph_submit(JobGraph* graph, Worker* worker) {
+    JobHandle handle = job_handle(graph->root);
+    // n_predecessors is only touched while building, the nodes' pending counts start moving as soon
+    // as the first node runs
+    for (JobGraphNode* node = graph->nodes; node != NULL; node = node->next) {
+        if (node->n_predecessors == 0) {
+            worker_submit(worker, node->job);
+        }
+    }
+    worker_submit(worker, graph->root);
+    return handle;
+}
+#pragma endregion
+
+#pragma region pipeline
+// NOTE(bryson): a stream of items pushed through a fixed sequence of stages, TBB style. A token carries
+// one item through all stages, and at most max_tokens of them exist, which bounds the items in flight.
+// The first stage produces the items and runs serially. A parallel stage takes any number of tokens at
+// once. A serial stage takes one at a time, in the order the first stage produced the items if it is
+// PIPELINE_SERIAL_IN_ORDER. A token that can't enter a serial stage parks there. The token leaving the
+// stage submits the next one as a new job, where thieves can pick it up, and carries on with its own
+// item. Nobody blocks and there are no barriers between stages. After the last stage the token goes
+// back to the first one for the next item.
+typedef enum PipelineStageKind {
+    PIPELINE_PARALLEL,
+    PIPELINE_SERIAL_IN_ORDER,
+    PIPELINE_SERIAL_OUT_OF_ORDER,
+} PipelineStageKind;
+
+// Gets the item returned by the previous stage and returns the one for the next. The first stage gets
+// NULL and returns NULL once the input is exhausted, the other stages must not return NULL.
+typedef void* (*PipelineFunc)(void* item, void* user);
+
+#define PIPELINE_MAX_STAGES 16
+
+typedef struct PipelineToken {
+    void* item;
+    // position of the item in the input, assigned by the first stage
+    u64 sequence;
+} PipelineToken;
+
+typedef struct PipelineStage {
+    PipelineStageKind kind;
+    PipelineFunc function;
+    // the rest is only used by serial stages
+    pthread_mutex_t lock;
+    b32 busy;
+    // sequence of the item the stage takes next, in-order stages only
+    u64 next_sequence;
+    // max_tokens entries. In-order stages park a token at sequence % max_tokens, which is free because
+    // the sequences of the tokens in flight span less than max_tokens. Out-of-order stages use a stack.
+    PipelineToken** parked;
+    u32 n_parked;
+} PipelineStage;
+
+typedef struct Pipeline {
+    Arena* arena;
+    Job* root;
+    void* user;
+    PipelineStage stages[PIPELINE_MAX_STAGES];
+    u32 n_stages;
+    u32 max_tokens;
+    PipelineToken* tokens;
+    // only touched by the token in the first stage
+    b32 input_done;
+    u64 n_items;
+} Pipeline;
+
+typedef struct PipelineJobData {
+    Pipeline* pipeline;
+    PipelineToken* token;
+    u32 stage;
+    // the token was handed a serial stage by the token that left it
+    b32 entered;
+} PipelineJobData;
+
+void pipeline_root_job(Job* job, void* data) {}
+
+// The pipeline lives in the arena, which has to outlive its execution. user is passed to every stage.
+Pipeline* pipeline_create(Arena* arena, u32 max_tokens, void* user) {
+    Assert(max_tokens > 0);
+    Pipeline* pipeline = arena_push(arena, Pipeline);
+    pipeline->arena = arena;
+    pipeline->root = job_create(&pipeline_root_job);
+    pipeline->user = user;
+    pipeline->n_stages = 0;
+    pipeline->max_tokens = max_tokens;
+    pipeline->tokens = arena_push_array(arena, PipelineToken, max_tokens);
+    pipeline->input_done = false;
+    pipeline->n_items = 0;
+    return pipeline;
+}
+
+// Appends a stage. The first stage produces the items and is serial whatever kind it is given.
+void pipeline_add_stage(Pipeline* pipeline, PipelineStageKind kind, PipelineFunc function) {
+    Assert(pipeline->n_stages < PIPELINE_MAX_STAGES);
+    PipelineStage* stage = &pipeline->stages[pipeline->n_stages++];
+    // the first stage defines the order, so there is none to keep yet
+    stage->kind = pipeline->n_stages == 1 ? PIPELINE_SERIAL_OUT_OF_ORDER : kind;
+    stage->function = function;
+    stage->busy = false;
+    stage->next_sequence = 0;
+    stage->parked = NULL;
+    stage->n_parked = 0;
+    if (stage->kind != PIPELINE_PARALLEL) {
+        pthread_mutex_init(&stage->lock, NULL);
+        stage->parked = arena_push_array(pipeline->arena, PipelineToken*, pipeline->max_tokens);
+        MemoryZero(stage->parked, sizeof(PipelineToken*) * pipeline->max_tokens);
+    }
+}
+
+// Returns true if the token may run the stage now, otherwise it was parked.
+b32 pipeline_stage_enter(Pipeline* pipeline, PipelineStage* stage, PipelineToken* token) {
+    pthread_mutex_lock(&stage->lock);
+    b32 in_order = stage->kind == PIPELINE_SERIAL_IN_ORDER;
+    b32 enter = !stage->busy && (!in_order || token->sequence == stage->next_sequence);
+    if (enter) {
+        stage->busy = true;
+    }
+    else if (in_order) {
+        Assert(stage->parked[token->sequence % pipeline->max_tokens] == NULL);
+        stage->parked[token->sequence % pipeline->max_tokens] = token;
+        stage->n_parked += 1;
+    }
+    else {
+        stage->parked[stage->n_parked++] = token;
+    }
+    pthread_mutex_unlock(&stage->lock);
+    return enter;
+}
+
+void pipeline_token_job(Job* job, void* data);
+
+// Hands the stage to the next parked token that may run it, if there is one.
+void pipeline_stage_leave(Pipeline* pipeline, u32 index) {
+    PipelineStage* stage = &pipeline->stages[index];
+    PipelineToken* next = NULL;
+
+    pthread_mutex_lock(&stage->lock);
+    if (stage->kind == PIPELINE_SERIAL_IN_ORDER) {
+        stage->next_sequence += 1;
+        PipelineToken** slot = &stage->parked[stage->next_sequence % pipeline->max_tokens];
+        if (*slot != NULL && (*slot)->sequence == stage->next_sequence) {
+            next = *slot;
+            *slot = NULL;
+            stage->n_parked -= 1;
+        }
+    }
+    else if (stage->n_parked > 0) {
+        next = stage->parked[--stage->n_parked];
+    }
+    // the stage stays busy while it changes hands
+    stage->busy = next != NULL;
+    pthread_mutex_unlock(&stage->lock);
+
+    if (next != NULL) {
+        PipelineJobData job_data = {
+            .pipeline = pipeline,
+            .token = next,
+            .stage = index,
+            .entered = true,
+        };
+        Job* job = job_create_child(pipeline->root, &pipeline_token_job);
+        job_write_data(job, (char*) &job_data, sizeof(PipelineJobData));
+        job_system_submit(job);
+    }
+}
+
+// Carries the token through the stages until it has to park or the input is exhausted.
+void pipeline_token_job(Job* job, void* data) {
+    PipelineJobData job_data = *(PipelineJobData*) data;
+    Pipeline* pipeline = job_data.pipeline;
+    PipelineToken* token = job_data.token;
+    u32 index = job_data.stage;
+    b32 entered = job_data.entered;
+
+    for (;;) {
+        PipelineStage* stage = &pipeline->stages[index];
+        b32 serial = stage->kind != PIPELINE_PARALLEL;
+        if (serial && !entered && !pipeline_stage_enter(pipeline, stage, token)) {
+            return;
+        }
+        entered = false;
+
+        if (index == 0) {
+            void* item = pipeline->input_done ? NULL : stage->function(NULL, pipeline->user);
+            if (item == NULL) {
+                // the token retires, the one taking over the stage finds the input done and follows
+                pipeline->input_done = true;
+                pipeline_stage_leave(pipeline, index);
+                return;
+            }
+            token->item = item;
+            token->sequence = pipeline->n_items++;
+        }
+        else {
+            token->item = stage->function(token->item, pipeline->user);
+        }
+
+        if (serial) {
+            pipeline_stage_leave(pipeline, index);
+        }
+        index = index + 1 < pipeline->n_stages ? index + 1 : 0;
+    }
+}
+
+// Starts every token at the first stage on worker. Waiting on the returned handle waits until the
+// input is exhausted and every item went through all stages. The pipeline runs once.
+JobHandle pipeline_submit(Pipeline* pipeline, Worker* worker) {
+    Assert(pipeline->n_stages > 0);
+    JobHandle handle = job_handle(pipeline->root);
+    for (u32 i = 0; i < pipeline->max_tokens; ++i) {
+        PipelineJobData job_data = {
+            .pipeline = pipeline,
+            .token = &pipeline->tokens[i],
+            .stage = 0,
+            .entered = false,
+        };
+        Job* job = job_create_child(pipeline->root, &pipeline_token_job);
+        job_write_data(job, (char*) &job_data, sizeof(PipelineJobData));
+        worker_submit(worker, job);
+    }
+    worker_submit(worker, pipeline->root);
+    return handle;
+}
+#pragma endregion
+
+#pragma region dispatch
+
+typedef void (*ParFunc)(void*, u32);
+typedef void (*ParRangeFunc)(u64 begin, u64 end, void* user);
+
+// NOTE(bryson): with lazy splitting the grain only bounds how much work is done between checks of the
+// local deque, so the default can be small. It is picked to give every worker this many chunks.
+#define PAR_DEFAULT_CHUNKS_PER_WORKER 8
+
+typedef struct ParallelForData {
+    u64 begin;
+    u64 end;
+    u64 grain_size;
+    // the elements for element loops, the user pointer for index loops
+    byte* data;
+    // set for element loops, func gets a pointer to element begin and the element count
+    u64 element_size;
+    ParFunc par_func;
+    // set for index loops
+    ParRangeFunc range_func;
+} ParallelForData;
+
+void parallel_for_run(ParallelForData* job_data, u64 begin, u64 end) {
+    if (begin == end) {
+        return;
+    }
+    if (job_data->range_func) {
+        (job_data->range_func)(begin, end, job_data->data);
+    }
+    else {
+        (job_data->par_func)(job_data->data + begin * job_data->element_size, (u32) (end - begin));
+    }
+}
+
+// Lazy binary splitting: the range is only halved while the local deque is empty, meaning nobody
+// else could pick up work from this worker. Otherwise one grain is run and the deque checked again,
+// so a thief taking the pushed half triggers the next split.
+void parallel_for_job(Job* job, void* data) {
+    ParallelForData job_data = *(ParallelForData*) data;
+    Worker* worker = job_system_thread_worker();
+
+    while (job_data.end - job_data.begin > job_data.grain_size) {
+        if (worker_queue_size(worker) == 0) {
+            u64 mid = job_data.begin + (job_data.end - job_data.begin) / 2;
+            ParallelForData right_data = job_data;
+            right_data.begin = mid;
+
+            Job* right = job_create_child(job, &parallel_for_job);
+            job_write_data(right, (char*)&right_data, sizeof(ParallelForData));
+            worker_submit(worker, right);
+
+            job_data.end = mid;
+        }
+        else {
+            parallel_for_run(&job_data, job_data.begin, job_data.begin + job_data.grain_size);
+            job_data.begin += job_data.grain_size;
+        }
+    }
+
+    parallel_for_run(&job_data, job_data.begin, job_data.end);
+}
+
+u64 parallel_for_grain_size(u64 count, u64 grain_size) {
+    if (grain_size == 0) {
+        grain_size = count / ((u64) _job_system.first_external * PAR_DEFAULT_CHUNKS_PER_WORKER);
+    }
+    return ClampBot(grain_size, 1);
+}
+
+// Runs par_func over count elements of element_size bytes starting at data, grain_size is a hint for
+// the smallest number of elements worth running on their own (0 picks one). The returned job still
+// has to be submitted.
+Job* parallel_for(void* data, u32 count, u32 element_size, u32 grain_size, ParFunc par_func) {
+    ParallelForData job_data = {
+        .begin = 0,
+        .end = count,
+        .grain_size = parallel_for_grain_size(count, grain_size),
+        .data = (byte*) data,
+        .element_size = element_size,
+        .par_func = par_func,
+        .range_func = NULL,
+    };
+
+    Job* job = job_create(&parallel_for_job);
+    job_write_data(job, (char*)&job_data, sizeof(ParallelForData));
+    return job;
+}
+
+Job* parallel_for_range_child(Job* parent, u64 begin, u64 end, u64 grain_size, ParRangeFunc range_func, void* user) {
+    ParallelForData job_data = {
+        .begin = begin,
+        .end = end,
+        .grain_size = parallel_for_grain_size(end - begin, grain_size),
+        .data = (byte*) user,
+        .element_size = 0,
+        .par_func = NULL,
+        .range_func = range_func,
+    };
+
+    Job* job = parent ? job_create_child(parent, &parallel_for_job) : job_create(&parallel_for_job);
+    job_write_data(job, (char*)&job_data, sizeof(ParallelForData));
+    return job;
+}
+
+// Runs range_func over sub-ranges of [begin, end).
+Job* parallel_for_range(u64 begin, u64 end, u64 grain_size, ParRangeFunc range_func, void* user) {
+    return parallel_for_range_child(NULL, begin, end, grain_size, range_func, user);
+}
+
+// folds count elements starting at data into partial
+typedef void (*ParReduceFunc)(void* data, u32 count, void* partial);
+// into = into <op> from
+typedef void (*ParCombineFunc)(void* into, void* from);
+// scans count elements from in to out starting from carry, carry holds the total afterwards
+typedef void (*ParScanFunc)(void* in, void* out, u32 count, void* carry, b32 inclusive);
+
+// NOTE(bryson): every worker folds the chunks it runs into its own partial, partials are padded to
+// whole cache lines so workers never write to the same line. Partials are combined in worker order,
+// so combine has to be associative and commutative. The struct has to outlive the returned job.
+typedef struct ParallelReduce {
+    void* data;
+    u32 count;
+    u32 element_size;
+    u32 grain_size;
+    ParReduceFunc reduce;
+    ParCombineFunc combine;
+    // size of identity, result and every partial
+    u32 result_size;
+    void* identity;
+    void* result;
+
+    byte* partials;
+    u64 partial_stride;
+} ParallelReduce;
+
+void parallel_reduce_chunk(u64 begin, u64 end, void* user) {
+    ParallelReduce* reduce = (ParallelReduce*) user;
+    Worker* worker = job_system_thread_worker();
+    byte* partial = reduce->partials + worker->index * reduce->partial_stride;
+    (reduce->reduce)((byte*) reduce->data + begin * reduce->element_size, (u32) (end - begin), partial);
+}
+
+void parallel_reduce_combine_job(Job* job, void* data) {
+    ParallelReduce* reduce = *(ParallelReduce**) data;
+    MemoryCopy(reduce->result, reduce->identity, reduce->result_size);
+    for (u32 i = 0; i < _job_system.n_workers; ++i) {
+        (reduce->combine)(reduce->result, reduce->partials + i * reduce->partial_stride);
+    }
+}
+
+void parallel_reduce_job(Job* job, void* data) {
+    ParallelReduce* reduce = *(ParallelReduce**) data;
+    for (u32 i = 0; i < _job_system.n_workers; ++i) {
+        MemoryCopy(reduce->partials + i * reduce->partial_stride, reduce->identity, reduce->result_size);
+    }
+
+    Job* loop = parallel_for_range_child(job, 0, reduce->count, reduce->grain_size, &parallel_reduce_chunk, reduce);
+    Job* combine = job_create_child(job, &parallel_reduce_combine_job);
+    job_write_data(combine, (char*)&reduce, sizeof(ParallelReduce*));
+    job_add_continuation(loop, combine);
+    worker_submit(job_system_thread_worker(), loop);
+}
+
+// Reduces reduce->count elements into reduce->result, the partials are allocated from arena. The
+// returned job still has to be submitted.
+Job* parallel_reduce(ParallelReduce* reduce, Arena* arena) {
+    reduce->partial_stride = (AlignUpPow2(reduce->result_size, CACHE_SIZE));
+    // arena allocations are only pointer aligned, over-allocate so the partials start on a cache line
+    byte* partials = arena_alloc(arena, reduce->partial_stride * _job_system.n_workers + CACHE_SIZE);
+    reduce->partials = (byte*) PtrFromInt((AlignUpPow2(IntFromPtr(partials), CACHE_SIZE)));
+
+    Job* job = job_create(&parallel_reduce_job);
+    job_write_data(job, (char*)&reduce, sizeof(ParallelReduce*));
+    return job;
+}
+
+// NOTE(bryson): two pass blocked scan. The input is cut into blocks, the first pass reduces every
+// block to its sum, a serial scan over the block sums gives every block its carry and the second pass
+// scans each block from its carry. The passes are chained with continuations, nobody blocks. in and
+// out may be the same array. The struct has to outlive the returned job.
+typedef struct ParallelScan {
+    void* in;
+    void* out;
+    u32 count;
+    u32 element_size;
+    // elements per block, 0 picks one
+    u32 block_size;
+    b32 inclusive;
+    ParReduceFunc reduce;
+    ParCombineFunc combine;
+    ParScanFunc scan;
+    // size of identity and the carries
+    u32 result_size;
+    void* identity;
+
+    byte* carries;
+    u32 n_blocks;
+} ParallelScan;
+
+void parallel_scan_reduce_blocks(u64 begin, u64 end, void* user) {
+    ParallelScan* scan = (ParallelScan*) user;
+    for (u64 block = begin; block < end; ++block) {
+        u64 first = block * scan->block_size;
+        u32 count = (u32) (Min(first + scan->block_size, (u64) scan->count) - first);
+        byte* carry = scan->carries + block * scan->result_size;
+        MemoryCopy(carry, scan->identity, scan->result_size);
+        (scan->reduce)((byte*) scan->in + first * scan->element_size, count, carry);
+    }
+}
+
+void parallel_scan_carries_job(Job* job, void* data) {
+    ParallelScan* scan = *(ParallelScan**) data;
+    // turn the block sums into exclusive carries, the scratch slot past the last block holds the sum
+    byte* running = scan->carries + scan->n_blocks * scan->result_size;
+    MemoryCopy(running, scan->identity, scan->result_size);
+    for (u32 block = 0; block < scan->n_blocks; ++block) {
+        byte* carry = scan->carries + block * scan->result_size;
+        byte* sum = running + scan->result_size;
+        MemoryCopy(sum, carry, scan->result_size);
+        MemoryCopy(carry, running, scan->result_size);
+        (scan->combine)(running, sum);
+    }
+}
+
+void parallel_scan_blocks(u64 begin, u64 end, void* user) {
+    ParallelScan* scan = (ParallelScan*) user;
+    for (u64 block = begin; block < end; ++block) {
+        u64 first = block * scan->block_size;
+        u32 count = (u32) (Min(first + scan->block_size, (u64) scan->count) - first);
+        byte* carry = scan->carries + block * scan->result_size;
+        (scan->scan)((byte*) scan->in + first * scan->element_size, (byte*) scan->out + first * scan->element_size,
+                     count, carry, scan->inclusive);
+    }
+}
+
+void parallel_scan_job(Job* job, void* data) {
+    ParallelScan* scan = *(ParallelScan**) data;
+
+    Job* reduce_pass = parallel_for_range_child(job, 0, scan->n_blocks, 1, &parallel_scan_reduce_blocks, scan);
+    Job* carries = job_create_child(job, &parallel_scan_carries_job);
+    job_write_data(carries, (char*)&scan, sizeof(ParallelScan*));
+    Job* scan_pass = parallel_for_range_child(job, 0, scan->n_blocks, 1, &parallel_scan_blocks, scan);
+
+    job_add_continuation(reduce_pass, carries);
+    job_add_continuation(carries, scan_pass);
+    worker_submit(job_system_thread_worker(), reduce_pass);
+}
+
+// Scans scan->count elements from scan->in into scan->out, the carries are allocated from arena. The
+// returned job still has to be submitted.
+Job* parallel_scan(ParallelScan* scan, Arena* arena) {
+    if (scan->block_size == 0) {
+        scan->block_size = (u32) ClampBot(scan->count / (_job_system.first_external * PAR_DEFAULT_CHUNKS_PER_WORKER), 1);
+    }
+    scan->n_blocks = (u32) ((scan->count + scan->block_size - 1) / scan->block_size);
+    // one carry per block plus two scratch slots for the serial pass
+    scan->carries = arena_alloc(arena, (u64) scan->result_size * (scan->n_blocks + 2));
+
+    Job* job = job_create(&parallel_scan_job);
+    job_write_data(job, (char*)&scan, sizeof(ParallelScan*));
+    return job;
+}
+
+#pragma endregion
+
+#pragma region tasks
+// NOTE(bryson): where a task leaves its return value. The slot belongs to whoever reads the value, the
+// task only gets a pointer to it, so it has to stay put until the task completed. Small values fit
+// inline (a Future keeps the slot inline), bigger ones get their storage from an arena.
+#define JOB_RESULT_INLINE_SIZE 32
+// JobResult.then once the value was stored
+#define JOB_RESULT_READY ((Job*) 1)
+
+typedef struct JobResult {
+    // the continuation waiting for the value, see task_then
+    Job* then;
+    u32 capacity;
+    u32 size;
+    // NULL if the value is stored inline
+    byte* external;
+    byte inline_value[JOB_RESULT_INLINE_SIZE];
+} JobResult;
+
+// a task function stores its value with job_return or one of the typed job_return_* wrappers
+typedef void (*TaskFunc)(Job* job, void* args, JobResult* result);
+
 typedef struct Task {
     Worker* worker;
     Job* job;
+    u32 generation;
+    // NULL for tasks launched without a result slot
+    JobResult* result;
 } Task;
 
+void job_result_init(JobResult* result) {
+    result->then = NULL;
+    result->capacity = JOB_RESULT_INLINE_SIZE;
+    result->size = 0;
+    result->external = NULL;
+}
+
+// a slot for values of up to capacity bytes that lives as long as the arena
+JobResult* job_result_create(Arena* arena, u32 capacity) {
+    JobResult* result = arena_push(arena, JobResult);
+    job_result_init(result);
+    if (capacity > JOB_RESULT_INLINE_SIZE) {
+        result->capacity = capacity;
+        result->external = arena_alloc_align(arena, capacity, JOB_PAYLOAD_ALIGNMENT);
+    }
+    return result;
+}
+
+byte* job_result_value(JobResult* result) {
+    return result->external ? result->external : result->inline_value;
+}
+
+b32 job_result_ready(JobResult* result) {
+    return atomic_load_acquire(&result->then) == JOB_RESULT_READY;
+}
+
+// hands a copy of the value to the continuation as its data
+void job_result_deliver(JobResult* result, Job* continuation) {
+    job_write_data(continuation, (char*) job_result_value(result), result->size);
+    job_system_submit(continuation);
+}
+
+// Stores the task's value, once per slot. Submits the continuation if one is waiting for it.
+void job_return(JobResult* result, void* value, u32 size) {
+    Assert(size <= result->capacity);
+    Assert(atomic_load_acquire(&result->then) != JOB_RESULT_READY);
+    if (size > 0) {
+        MemoryCopy(job_result_value(result), value, size);
+    }
+    result->size = size;
+
+    Job* then = __atomic_exchange_n(&result->then, JOB_RESULT_READY, __ATOMIC_ACQ_REL);
+    if (then != NULL) {
+        job_result_deliver(result, then);
+    }
+}
+
+typedef struct TaskHeader {
+    TaskFunc function;
+    JobResult* result;
+} TaskHeader;
+
+// runs a TaskFunc, the arguments follow the header in the job's data
+void task_job(Job* job, void* data) {
+    TaskHeader* header = (TaskHeader*) data;
+    header->function(job, (byte*) data + sizeof(TaskHeader), header->result);
+    // a task that returned nothing still releases its continuation, with empty data
+    if (!job_result_ready(header->result)) {
+        job_return(header->result, NULL, 0);
+    }
+}
+
 Task task_launch(JobFunc function) {
     Job* job = job_create(function);
+    JobHandle handle = job_handle(job);
+    Worker* worker = job_system_thread_worker();
+    job_system_submit(job);
+    Task task = {.worker = worker, .job = job, .generation = handle.generation, .result = NULL};
+    return task;
+}
+
+// Runs function with a copy of args_size bytes of args and result as its slot.
+Task task_launch_with_result(TaskFunc function, void* args, u32 args_size, JobResult* result) {
+    Job* job = job_create(&task_job);
+    byte* data = job_reserve_data(job, sizeof(TaskHeader) + args_size);
+    TaskHeader header = {
+        .function = function,
+        .result = result,
+    };
+    MemoryCopy(data, &header, sizeof(TaskHeader));
+    if (args_size > 0) {
+        MemoryCopy(data + sizeof(TaskHeader), args, args_size);
+    }
+
+    JobHandle handle = job_handle(job);
     Worker* worker = job_system_thread_worker();
-    worker_submit(worker, job);
-    Task task = {.worker =worker, .job = job};
+    job_system_submit(job);
+    Task task = {.worker = worker, .job = job, .generation = handle.generation, .result = result};
     return task;
 }
 
 void task_wait(Task* task) {
-    worker_wait(task->worker, task->job);
+    JobHandle handle = {.job = task->job, .generation = task->generation};
+    job_system_wait(handle);
+}
+
+// waits for the task and returns a pointer to its value in the slot
+void* task_result(Task* task) {
+    Assert(task->result != NULL);
+    task_wait(task);
+    return job_result_value(task->result);
+}
+
+// Runs function once the task stored its value, with a copy of the value as its data. The slot has to
+// stay valid until then. One continuation per task.
+void task_then(Task* task, JobFunc function) {
+    Assert(task->result != NULL);
+    Job* continuation = job_create(function);
+    Job* expected = NULL;
+    if (!atomic_compare_exchange(&task->result->then, &expected, continuation)) {
+        Assert(expected == JOB_RESULT_READY);
+        job_result_deliver(task->result, continuation);
+    }
+}
+
+// NOTE(bryson): a task together with its result slot. Launched in place because the task keeps a
+// pointer to the slot, the future must not move (or go out of scope) before the task completed.
+typedef struct Future {
+    Task task;
+    JobResult slot;
+} Future;
+
+void future_launch(Future* future, TaskFunc function, void* args, u32 args_size) {
+    job_result_init(&future->slot);
+    future->task = task_launch_with_result(function, args, args_size, &future->slot);
+}
+
+b32 future_ready(Future* future) {
+    return job_result_ready(&future->slot);
+}
+
+void* future_wait(Future* future) {
+    return task_result(&future->task);
 }
 
+void future_then(Future* future, JobFunc function) {
+    task_then(&future->task, function);
+}
+
+// typed wrappers: job_return_u64(result, value), future_get_u64(future) and task_result_u64(task)
+#define JOB_RESULT_DEFINE(T, name)\
+    void job_return_##name(JobResult* result, T value) { job_return(result, &value, sizeof(T)); }\
+    T future_get_##name(Future* future) { return *(T*) future_wait(future); }\
+    T task_result_##name(Task* task) { return *(T*) task_result(task); }
+
+JOB_RESULT_DEFINE(u32, u32)
+JOB_RESULT_DEFINE(u64, u64)
+JOB_RESULT_DEFINE(i64, i64)
+JOB_RESULT_DEFINE(f64, f64)
+JOB_RESULT_DEFINE(void*, ptr)
+#pragma endregion
+
+
+
+
+
 
 
 
 
 
+#pragma region job_groups
+void job_group_root(Job* job, void* data) {}
 
+// Starts an empty group. Its jobs are created with job_group_create and submitted like any other job.
+void job_group_init(JobGroup* group) {
+    group->root = job_create(&job_group_root);
+    group->root->group = group;
+    group->generation = job_handle(group->root).generation;
+    group->cancelled = false;
+}
+
+// a job of the group, children it creates with job_create_child belong to the group as well
+Job* job_group_create(JobGroup* group, JobFunc function) {
+    return job_create_child(group->root, function);
+}
+
+// Asks every job of the group to stop. Safe from any thread, including the group's own jobs.
+void job_group_cancel(JobGroup* group) {
+    atomic_store_release(&group->cancelled, true);
+}
 
+b32 job_group_cancelled(JobGroup* group) {
+    return atomic_load_relaxed(&group->cancelled);
+}
 
+// Waits until every job of the group completed or was dropped, running other jobs meanwhile. The group
+// takes no new jobs afterwards, init it again to reuse it.
+void job_group_wait(JobGroup* group) {
+    JobHandle handle = {.job = group->root, .generation = group->generation};
+    // the root never runs, giving up its own count leaves it to the last job of the group
+    job_finish(group->root);
+    job_system_wait(handle);
+}
+#pragma endregion
@@ -25,7 +25,7 @@
         #define ARCH_X86 1
     #elif defined(__arm__)
         #define ARCH_ARM 1
-    #elif defined(__arch64__)
+    #elif defined(__aarch64__)
         #define ARCH_ARM64 1
     #else
         #error Missing ARCH detection
@@ -67,7 +67,7 @@
         #define ARCH_X86 1
     #elif defined(__arm__)
         #define ARCH_ARM 1
-    #elif defined(__arch64__)
+    #elif defined(__aarch64__)
         #define ARCH_ARM64 1
     #else
         #error Missing ARCH detection
@@ -1,53 +1,210 @@
 #pragma once
 
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "language_layer.h"
 
-#define arena_push_array(a,T,c) (T*)arena_alloc(a, sizeof(T)*c)
+#define arena_push_array(a,T,c) (T*)arena_alloc(a, sizeof(T)*(c))
 #define arena_push(a,T) arena_push_array(a, T, 1)
+// for memory that is written in full right away, see arena_alloc_align_no_zero
+#define arena_push_array_no_zero(a,T,c) (T*)arena_alloc_no_zero(a, sizeof(T)*(c))
+#define arena_push_no_zero(a,T) arena_push_array_no_zero(a, T, 1)
 #define arena_def(a,T,n,val)\
     T* n = arena_push(a, T);\
     *(n) = (val)\
 
 #define MEM_DEFAULT_ALIGNMENT sizeof(void*)
+#define MEM_HUGE_PAGE_SIZE Megabytes(2)
+#define MEM_CACHE_LINE_SIZE 64
 
+// NOTE(bryson): arena_create mallocs a fixed block. arena_reserve only reserves address space instead
+// and commits pages as alloc_pos grows, so the arena can be sized for the worst case while memory use
+// follows what is actually allocated. Pointers stay put either way. Rewinding a reserved arena (clear,
+// temp_arena_end, arena_dealloc*) gives committed pages back to the OS once more than
+// decommit_threshold bytes of them sit past alloc_pos.
+//
+// Fresh memory from the OS is already zero, only memory that was handed out before and rewound has to
+// be cleared. The arena remembers how far it was ever used (dirty) and arena_alloc only zeroes below
+// that. The _no_zero variants skip zeroing altogether for memory the caller overwrites anyway.
 typedef struct Arena {
 	byte* data;
 	u64 alloc_pos;
 	u64 capacity;
+	// [0, committed) is backed by memory, all of it for arenas from arena_create
+	u64 committed;
+	// [dirty, committed) is still zero
+	u64 dirty;
+	// reserved arenas only
+	u64 commit_size;
+	u64 decommit_threshold;
+	b32 reserved;
 } Arena;
 
+typedef struct ArenaOptions {
+    // address space to reserve, the arena never grows past it
+    u64 reserve_size;
+    // pages are committed in steps of this size
+    u64 commit_size;
+    // ask for transparent huge pages, commit_size is rounded up to MEM_HUGE_PAGE_SIZE
+    b32 huge_pages;
+    // committed memory further than this past alloc_pos is released when the arena is rewound
+    u64 decommit_threshold;
+} ArenaOptions;
+
+ArenaOptions arena_default_options() {
+    ArenaOptions options = {
+        .reserve_size = Gigabytes(64),
+        .commit_size = Kilobytes(64),
+        .huge_pages = false,
+        .decommit_threshold = Megabytes(16),
+    };
+    return options;
+}
+
 Arena arena_create(u64 size) {
     Arena arena = {
-        .data = (byte*) malloc(size),
+        // large blocks come straight from mmap and are zero already, calloc knows when it has to clear
+        .data = (byte*) calloc(1, size),
         .alloc_pos = 0,
         .capacity = size,
+        .committed = size,
+        .dirty = 0,
+        .commit_size = 0,
+        .decommit_threshold = 0,
+        .reserved = false,
     };
     return arena;
 }
 
-byte* arena_alloc_align(Arena* arena, u64 size, u64 align) {
+Arena arena_reserve(ArenaOptions options) {
+    u64 page_size = (u64) sysconf(_SC_PAGESIZE);
+    u64 commit_size = (AlignUpPow2(ClampBot(options.commit_size, page_size), page_size));
+    if (options.huge_pages) {
+        commit_size = (AlignUpPow2(commit_size, MEM_HUGE_PAGE_SIZE));
+    }
+    u64 reserve_size = (AlignUpPow2(options.reserve_size, commit_size));
+
+    // huge pages need a 2MB aligned range, so reserve one huge page more and trim the ends
+    u64 slack = options.huge_pages ? MEM_HUGE_PAGE_SIZE : 0;
+    byte* mapping = (byte*) mmap(NULL, reserve_size + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    Assert(mapping != MAP_FAILED);
+    byte* data = mapping;
+    if (options.huge_pages) {
+        data = (byte*) PtrFromInt((AlignUpPow2(IntFromPtr(mapping), MEM_HUGE_PAGE_SIZE)));
+        if (data > mapping) {
+            munmap(mapping, data - mapping);
+        }
+        if (data + reserve_size < mapping + reserve_size + slack) {
+            munmap(data + reserve_size, (mapping + reserve_size + slack) - (data + reserve_size));
+        }
+#if defined(MADV_HUGEPAGE)
+        // only a hint, kernels without THP just keep using small pages
+        madvise(data, reserve_size, MADV_HUGEPAGE);
+#endif
+    }
+
+    Arena arena = {
+        .data = data,
+        .alloc_pos = 0,
+        .capacity = reserve_size,
+        .committed = 0,
+        .dirty = 0,
+        .commit_size = commit_size,
+        .decommit_threshold = options.decommit_threshold,
+        .reserved = true,
+    };
+    return arena;
+}
+
+// Makes sure [0, end) is committed. Returns false past the reservation or for arenas from arena_create.
+b32 arena_commit(Arena* arena, u64 end) {
+    if (!arena->reserved || end > arena->capacity) {
+        return false;
+    }
+    u64 committed = ClampTop((AlignUpPow2(end, arena->commit_size)), arena->capacity);
+    if (mprotect(arena->data + arena->committed, committed - arena->committed, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    arena->committed = committed;
+    return true;
+}
+
+// gives committed pages more than decommit_threshold past alloc_pos back to the OS
+void arena_decommit_unused(Arena* arena) {
+    if (!arena->reserved || arena->committed - arena->alloc_pos <= arena->decommit_threshold) {
+        return;
+    }
+    u64 keep = ClampTop((AlignUpPow2(arena->alloc_pos + arena->decommit_threshold, arena->commit_size)), arena->committed);
+    madvise(arena->data + keep, arena->committed - keep, MADV_DONTNEED);
+    mprotect(arena->data + keep, arena->committed - keep, PROT_NONE);
+    arena->committed = keep;
+    // the pages come back zeroed the next time they are committed
+    arena->dirty = ClampTop(arena->dirty, keep);
+}
+
+// The returned memory starts at a multiple of align and holds whatever was there before.
+byte* arena_alloc_align_no_zero(Arena* arena, u64 size, u64 align) {
     byte* res = NULL;
     u64 alloc_size = AlignUpPow2(size, align);
-    if (arena->alloc_pos + alloc_size <= arena->capacity) {
-        res = arena->data + arena->alloc_pos;
-        MemoryZero(res, alloc_size);
-        arena->alloc_pos += alloc_size;
+    u64 start = (AlignUpPow2(IntFromPtr(arena->data + arena->alloc_pos), align)) - IntFromPtr(arena->data);
+    u64 end = start + alloc_size;
+    if (end <= arena->committed || arena_commit(arena, end)) {
+        res = arena->data + start;
+        arena->alloc_pos = end;
+        arena->dirty = Max(arena->dirty, end);
     }
     return res;
 }
 
+// the slow path of arena_alloc_align, for allocations that reach past dirty
+byte* arena_alloc_fresh(Arena* arena, u64 start, u64 end) {
+    if (end > arena->committed && !arena_commit(arena, end)) {
+        return NULL;
+    }
+    arena->alloc_pos = end;
+    // only the part below dirty was handed out before, the rest is still zero from the OS
+    if (start < arena->dirty) {
+        MemoryZero(arena->data + start, arena->dirty - start);
+    }
+    arena->dirty = end;
+    return arena->data + start;
+}
+
+// The returned memory is zeroed and starts at a multiple of align.
+byte* arena_alloc_align(Arena* arena, u64 size, u64 align) {
+    u64 alloc_size = AlignUpPow2(size, align);
+    u64 start = (AlignUpPow2(IntFromPtr(arena->data + arena->alloc_pos), align)) - IntFromPtr(arena->data);
+    u64 end = start + alloc_size;
+    // dirty never passes committed, so this also covers running out of committed memory
+    if (end > arena->dirty) {
+        return arena_alloc_fresh(arena, start, end);
+    }
+    byte* res = arena->data + start;
+    MemoryZero(res, alloc_size);
+    arena->alloc_pos = end;
+    return res;
+}
+
 byte* arena_alloc(Arena* arena, u64 size) {
     return arena_alloc_align(arena, size, MEM_DEFAULT_ALIGNMENT);
 }
 
+byte* arena_alloc_no_zero(Arena* arena, u64 size) {
+    return arena_alloc_align_no_zero(arena, size, MEM_DEFAULT_ALIGNMENT);
+}
+
 void arena_dealloc_align(Arena* arena, u64 size, u64 align) {
     u64 dealloc_size = AlignUpPow2(size, align);
     arena->alloc_pos = ClampBot(arena->alloc_pos - dealloc_size, 0);
+    arena_decommit_unused(arena);
 }
 
 void arena_dealloc_to_align(Arena* arena, u64 pos, u64 align) {
     u64 pos_diff = AlignUpPow2(ClampBot(arena->alloc_pos - pos, 0), align);
     arena->alloc_pos -= pos_diff;
+    arena_decommit_unused(arena);
 }
 
 void arena_dealloc_to(Arena* arena, u64 pos) {
@@ -60,12 +217,19 @@ void arena_dealloc(Arena* arena, u64 size) {
 
 void clear(Arena* arena) {
     arena->alloc_pos = 0;
+    arena_decommit_unused(arena);
 }
 
 void arena_release(Arena* arena) {
-    free(arena->data);
+    if (arena->reserved) {
+        munmap(arena->data, arena->capacity);
+    }
+    else {
+        free(arena->data);
+    }
     arena->alloc_pos = 0;
     arena->capacity = 0;
+    arena->committed = 0;
 }
 
 typedef struct TempArena {
@@ -84,3 +248,187 @@ TempArena temp_arena_begin(Arena* arena) {
 void temp_arena_end(TempArena* tmp) {
     arena_dealloc_to(tmp->arena, tmp->start_pos);
 }
+
+#pragma region pool
+#define pool_create_typed(a,T,n) pool_create(a, sizeof(T), n)
+// T has to fit the pool's element_size
+#define pool_push(p,T) (T*)pool_alloc(p)
+#define pool_push_no_zero(p,T) (T*)pool_alloc_no_zero(p)
+
+// elements moved between a PoolCache and its pool at once
+#define POOL_CACHE_BATCH 32
+
+// NOTE(bryson): fixed-size elements that are allocated and freed over and over, on top of an arena.
+// The pool carves cache line aligned slabs of elements_per_slab elements out of the arena and hands them
+// out front to back, a freed element goes on an intrusive free list (its first bytes are the link) and
+// is handed out again before the slab moves on. Both are O(1), and memory only goes back to the arena
+// when the arena itself is rewound, which also takes the pool with it.
+//
+// The pool itself is single-threaded. Threads that share one go through a PoolCache each: a cache keeps
+// a free list of its own and only takes the pool's lock to move POOL_CACHE_BATCH elements in or out.
+typedef struct PoolNode {
+    struct PoolNode* next;
+} PoolNode;
+
+typedef struct Pool {
+    Arena* arena;
+    // freed elements, handed out first
+    PoolNode* free_list;
+    // the part of the newest slab that was never handed out
+    byte* slab_pos;
+    byte* slab_end;
+    u64 element_size;
+    u64 slab_size;
+    // only taken by the pool_cache functions
+    pthread_mutex_t lock;
+} Pool;
+
+Pool pool_create(Arena* arena, u64 element_size, u32 elements_per_slab) {
+    element_size = AlignUpPow2(ClampBot(element_size, sizeof(PoolNode)), MEM_DEFAULT_ALIGNMENT);
+    Pool pool = {
+        .arena = arena,
+        .free_list = NULL,
+        .slab_pos = NULL,
+        .slab_end = NULL,
+        .element_size = element_size,
+        .slab_size = element_size * ClampBot(elements_per_slab, 1),
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    return pool;
+}
+
+// The returned element holds whatever was there before. Returns NULL once the arena is full.
+byte* pool_alloc_no_zero(Pool* pool) {
+    PoolNode* node = pool->free_list;
+    if (node != NULL) {
+        pool->free_list = node->next;
+        return (byte*) node;
+    }
+    if (pool->slab_pos == pool->slab_end) {
+        byte* slab = arena_alloc_align_no_zero(pool->arena, pool->slab_size, MEM_CACHE_LINE_SIZE);
+        if (slab == NULL) {
+            return NULL;
+        }
+        pool->slab_pos = slab;
+        pool->slab_end = slab + pool->slab_size;
+    }
+    byte* res = pool->slab_pos;
+    pool->slab_pos += pool->element_size;
+    return res;
+}
+
+// The returned element is zeroed.
+byte* pool_alloc(Pool* pool) {
+    byte* res = pool_alloc_no_zero(pool);
+    if (res != NULL) {
+        MemoryZero(res, pool->element_size);
+    }
+    return res;
+}
+
+void pool_free(Pool* pool, void* element) {
+    Assert(element != NULL);
+    PoolNode* node = (PoolNode*) element;
+    node->next = pool->free_list;
+    pool->free_list = node;
+}
+
+// Forgets every element, for after the arena was rewound to before the pool's first slab.
+void pool_reset(Pool* pool) {
+    pool->free_list = NULL;
+    pool->slab_pos = NULL;
+    pool->slab_end = NULL;
+}
+
+typedef struct PoolCache {
+    Pool* pool;
+    PoolNode* free_list;
+    u32 count;
+} PoolCache;
+
+// One per thread (or per worker, indexed by the worker's index), never shared.
+PoolCache pool_cache_create(Pool* pool) {
+    PoolCache cache = {
+        .pool = pool,
+        .free_list = NULL,
+        .count = 0,
+    };
+    return cache;
+}
+
+void pool_cache_refill(PoolCache* cache) {
+    Pool* pool = cache->pool;
+    pthread_mutex_lock(&pool->lock);
+    for (u32 i = 0; i < POOL_CACHE_BATCH; ++i) {
+        PoolNode* node = (PoolNode*) pool_alloc_no_zero(pool);
+        if (node == NULL) {
+            break;
+        }
+        node->next = cache->free_list;
+        cache->free_list = node;
+        cache->count += 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Gives up to count elements back to the pool, the list is cut outside of the lock and spliced in under it.
+void pool_cache_flush_count(PoolCache* cache, u32 count) {
+    if (cache->free_list == NULL || count == 0) {
+        return;
+    }
+    PoolNode* first = cache->free_list;
+    PoolNode* last = first;
+    u32 n = 1;
+    while (n < count && last->next != NULL) {
+        last = last->next;
+        n += 1;
+    }
+    cache->free_list = last->next;
+    cache->count -= n;
+
+    Pool* pool = cache->pool;
+    pthread_mutex_lock(&pool->lock);
+    last->next = pool->free_list;
+    pool->free_list = first;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Gives every cached element back to the pool, e.g. before the thread goes away.
+void pool_cache_flush(PoolCache* cache) {
+    pool_cache_flush_count(cache, cache->count);
+}
+
+// Like pool_alloc_no_zero, but only takes the pool's lock when the cache ran dry.
+byte* pool_cache_alloc_no_zero(PoolCache* cache) {
+    if (cache->free_list == NULL) {
+        pool_cache_refill(cache);
+        if (cache->free_list == NULL) {
+            return NULL;
+        }
+    }
+    PoolNode* node = cache->free_list;
+    cache->free_list = node->next;
+    cache->count -= 1;
+    return (byte*) node;
+}
+
+byte* pool_cache_alloc(PoolCache* cache) {
+    byte* res = pool_cache_alloc_no_zero(cache);
+    if (res != NULL) {
+        MemoryZero(res, cache->pool->element_size);
+    }
+    return res;
+}
+
+// The element may come from any cache of the same pool. Once the cache holds two batches, one goes back.
+void pool_cache_free(PoolCache* cache, void* element) {
+    Assert(element != NULL);
+    PoolNode* node = (PoolNode*) element;
+    node->next = cache->free_list;
+    cache->free_list = node;
+    cache->count += 1;
+    if (cache->count >= 2 * POOL_CACHE_BATCH) {
+        pool_cache_flush_count(cache, POOL_CACHE_BATCH);
+    }
+}
+#pragma endregion
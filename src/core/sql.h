@@ -5,6 +5,7 @@
 #include <sqlite3.h>
 
 #include "str.h"
+#include "jobs.h"
 
 #define SQL_CHECK(db,rc,msg)\
     do {\
@@ -62,8 +63,11 @@ void sql_db_close(SQLDB* db) {
     sqlite3_close(db->db_ptr);
 }
 
+// sqlite blocks on disk and on other connections' locks, so a spare worker (if any) takes over meanwhile
 void sql_db_submit(SQLDB* db, SQLCommand* cmd) {
+    job_blocking_begin();
     sql_exec(db, cmd);
+    job_blocking_end();
 }
 
 void sql_db_prepare(SQLDB* db, SQLCommand* cmd) {
@@ -71,7 +75,10 @@ void sql_db_prepare(SQLDB* db, SQLCommand* cmd) {
 }
 
 i32 sql_db_step(SQLDB* db) {
-    return sqlite3_step(db->res); 
+    job_blocking_begin();
+    i32 result = sqlite3_step(db->res);
+    job_blocking_end();
+    return result;
 }
 
 SQLCommandBuffer sql_command_buffer_begin(Arena* arena) {
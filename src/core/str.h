@@ -20,6 +20,8 @@ typedef struct StringBuilder {
     StringBuilderNode* end;
 
     Arena* arena;
+    // optional, nodes come from here instead of the arena and string_builder_reset gives them back
+    Pool* node_pool;
     u32 n_nodes;
     u32 size;
 } StringBuilder;
@@ -41,12 +43,24 @@ StringBuilder string_builder_create(Arena* arena) {
         .start = NULL,
         .end = NULL,
         .arena = arena,
+        .node_pool = NULL,
     };
     return sb;
 }
 
+// For builders that are filled and reset over and over. node_pool holds StringBuilderNodes, see
+// pool_create_typed, and can be shared by any number of builders on one thread.
+StringBuilder string_builder_create_pooled(Arena* arena, Pool* node_pool) {
+    Assert(node_pool->element_size >= sizeof(StringBuilderNode));
+    StringBuilder sb = string_builder_create(arena);
+    sb.node_pool = node_pool;
+    return sb;
+}
+
 void string_builder_append(StringBuilder* sb, char* str) {
-    StringBuilderNode* node = arena_push(sb->arena, StringBuilderNode); 
+    StringBuilderNode* node = sb->node_pool ? pool_push_no_zero(sb->node_pool, StringBuilderNode)
+                                            : arena_push_no_zero(sb->arena, StringBuilderNode);
+    Assert(node != NULL);
     node->str = string_create(sb->arena, str);
     node->next = NULL;
 
@@ -79,6 +93,22 @@ String string_builder_build(StringBuilder* sb) {
     return str;
 }
 
+// Empties the builder, the nodes go back to the node pool if it has one. The appended strings stay in
+// the arena.
+void string_builder_reset(StringBuilder* sb) {
+    if (sb->node_pool != NULL) {
+        for (StringBuilderNode* node = sb->start; node != NULL;) {
+            StringBuilderNode* next = node->next;
+            pool_free(sb->node_pool, node);
+            node = next;
+        }
+    }
+    sb->start = NULL;
+    sb->end = NULL;
+    sb->n_nodes = 0;
+    sb->size = 0;
+}
+
 
 
 
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "language_layer.h"
+#include "mem.h"
+
+// NOTE(bryson): logical cpus as seen by the scheduler. core, llc and package are ids of the first
+// cpu in the respective sibling list, so two cpus share a core/cache/socket iff the ids match.
+typedef struct CpuInfo {
+    u32 cpu;
+    u32 core;
+    u32 llc;
+    u32 package;
+} CpuInfo;
+
+typedef struct CpuTopology {
+    CpuInfo* cpus;
+    u32 n_cpus;
+} CpuTopology;
+
+typedef enum CpuDistance {
+    CPU_DISTANCE_SMT,
+    CPU_DISTANCE_CACHE,
+    CPU_DISTANCE_PACKAGE,
+    CPU_DISTANCE_REMOTE,
+    CPU_DISTANCE_COUNT,
+} CpuDistance;
+
+#define CPU_SYSFS_PATH "/sys/devices/system/cpu"
+#define CPU_MAX_CACHE_INDEX 8
+
+// reads the first unsigned integer in a sysfs file, which for cpu lists like "0-3,8-11" is the
+// lowest cpu in the list
+b32 sysfs_read_u32(char* path, u32* value) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    b32 read = fscanf(file, "%u", value) == 1;
+    fclose(file);
+    return read;
+}
+
+b32 sysfs_read_str(char* path, char* buffer, u32 size) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    b32 read = fgets(buffer, size, file) != NULL;
+    fclose(file);
+    return read;
+}
+
+CpuInfo cpu_info_read(u32 cpu) {
+    CpuInfo info = {
+        .cpu = cpu,
+        .core = cpu,
+        .llc = 0,
+        .package = 0,
+    };
+
+    char path[256];
+    snprintf(path, sizeof(path), CPU_SYSFS_PATH "/cpu%u/topology/physical_package_id", cpu);
+    sysfs_read_u32(path, &info.package);
+
+    snprintf(path, sizeof(path), CPU_SYSFS_PATH "/cpu%u/topology/thread_siblings_list", cpu);
+    if (!sysfs_read_u32(path, &info.core)) {
+        snprintf(path, sizeof(path), CPU_SYSFS_PATH "/cpu%u/topology/core_cpus_list", cpu);
+        sysfs_read_u32(path, &info.core);
+    }
+
+    // the last level cache is the highest level data or unified cache
+    u32 llc_level = 0;
+    info.llc = info.package;
+    for (u32 i = 0; i < CPU_MAX_CACHE_INDEX; ++i) {
+        u32 level = 0;
+        snprintf(path, sizeof(path), CPU_SYSFS_PATH "/cpu%u/cache/index%u/level", cpu, i);
+        if (!sysfs_read_u32(path, &level)) {
+            break;
+        }
+
+        char type[32] = {0};
+        snprintf(path, sizeof(path), CPU_SYSFS_PATH "/cpu%u/cache/index%u/type", cpu, i);
+        if (sysfs_read_str(path, type, sizeof(type)) && strncmp(type, "Instruction", 11) == 0) {
+            continue;
+        }
+
+        u32 llc = 0;
+        snprintf(path, sizeof(path), CPU_SYSFS_PATH "/cpu%u/cache/index%u/shared_cpu_list", cpu, i);
+        if (level > llc_level && sysfs_read_u32(path, &llc)) {
+            llc_level = level;
+            info.llc = llc;
+        }
+    }
+
+    return info;
+}
+
+int cpu_info_compare(const void* a, const void* b) {
+    const CpuInfo* x = (const CpuInfo*) a;
+    const CpuInfo* y = (const CpuInfo*) b;
+    if (x->package != y->package) return x->package < y->package ? -1 : 1;
+    if (x->llc != y->llc) return x->llc < y->llc ? -1 : 1;
+    if (x->core != y->core) return x->core < y->core ? -1 : 1;
+    if (x->cpu != y->cpu) return x->cpu < y->cpu ? -1 : 1;
+    return 0;
+}
+
+// Returns the cpus this process may run on, sorted so that neighbours share as much as possible
+// (package, then last level cache, then core). Falls back to a flat topology off Linux.
+CpuTopology cpu_topology_read(Arena* arena) {
+    CpuTopology topology = {0};
+
+#if defined(__gnu_linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        u32 n_allowed = (u32) CPU_COUNT(&allowed);
+        topology.cpus = arena_push_array(arena, CpuInfo, n_allowed);
+        for (u32 cpu = 0; cpu < CPU_SETSIZE && topology.n_cpus < n_allowed; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                topology.cpus[topology.n_cpus++] = cpu_info_read(cpu);
+            }
+        }
+        qsort(topology.cpus, topology.n_cpus, sizeof(CpuInfo), cpu_info_compare);
+        return topology;
+    }
+#endif
+
+    u32 n_cpus = (u32) ClampBot(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    topology.cpus = arena_push_array(arena, CpuInfo, n_cpus);
+    topology.n_cpus = n_cpus;
+    for (u32 cpu = 0; cpu < n_cpus; ++cpu) {
+        CpuInfo info = {.cpu = cpu, .core = cpu, .llc = 0, .package = 0};
+        topology.cpus[cpu] = info;
+    }
+    return topology;
+}
+
+CpuDistance cpu_distance(CpuInfo* a, CpuInfo* b) {
+    if (a->core == b->core) return CPU_DISTANCE_SMT;
+    if (a->llc == b->llc) return CPU_DISTANCE_CACHE;
+    if (a->package == b->package) return CPU_DISTANCE_PACKAGE;
+    return CPU_DISTANCE_REMOTE;
+}
+
+b32 cpu_pin_thread(pthread_t thread, u32 cpu) {
+#if defined(__gnu_linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Threads created with attr may run on the cpus the calling thread may run on right now, rather than
+// inheriting the affinity of whichever thread creates them later on.
+b32 cpu_thread_attr_init(pthread_attr_t* attr) {
+    pthread_attr_init(attr);
+#if defined(__gnu_linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    return sched_getaffinity(0, sizeof(set), &set) == 0 && pthread_attr_setaffinity_np(attr, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
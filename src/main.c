@@ -26,7 +26,7 @@ void update_particles(void* data, u32 count) {
    for (i32 i = 0; i < count; ++i) {
        particles[i].x += particles[i].x_vel;
 
-       u32 idx = (data - (void*) &g_particles) + i;
+       u32 idx = (particles - g_particles) + i;
        printf("idx: %d, x: %d, x_vel: %d\n", idx, g_particles[idx].x, g_particles[idx].x_vel);
    }
 }
@@ -39,10 +39,12 @@ int main (void) {
     Worker* worker = job_system_thread_worker();
 
     Job* root = job_create(&empty_job);
-    for (int i = 0; i < _job_system.n_workers; ++i) {
-        Job* j = job_create_child(root, &empty_job);
-        worker_submit(worker, j);
+    Job* children[MAX_JOB_COUNT];
+    u32 n_children = Min(_job_system.first_external, MAX_JOB_COUNT);
+    for (int i = 0; i < n_children; ++i) {
+        children[i] = job_create_child(root, &empty_job);
     }
+    worker_submit_batch(worker, children, n_children);
     worker_submit(worker, root);
 
     worker_wait(worker, root);
@@ -56,7 +58,7 @@ int main (void) {
         g_particles[i].x_vel = i;
     }
 
-    Job* p = parallel_for(&g_particles, N_PARTICLES, &update_particles);
+    Job* p = parallel_for(g_particles, N_PARTICLES, sizeof(Particle), 0, &update_particles);
     worker_submit(worker, p);
     worker_wait(worker, p);
 